@@ -0,0 +1,218 @@
+#include "asmgen.h"
+#include <algorithm>
+#include <format>
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+void asm_gen_error(string msg) {
+    cout << msg << endl;
+    exit(14);
+}
+
+AsmGen::AsmGen(const Chunk& chunk, const RegAlloc& alloc, const Interner& names):
+    chunk(chunk), alloc(alloc), names(names) {
+    if(alloc.num_regs > pool_size) {
+        asm_gen_error(std::format("Allocation uses {} registers, only {} available", alloc.num_regs, pool_size));
+    }
+}
+
+string AsmGen::asm_gen() {
+    vector<bool> is_target(chunk.code.size() + 1);
+    for(const Instr& in : chunk.code) {
+        if(in.op == Op::jmp) {
+            is_target[in.a] = true;
+        }
+        else if(in.op == Op::jnz) {
+            is_target[in.b] = true;
+        }
+    }
+
+    writeln("    .section .rodata");
+    writeln(".Lprint_fmt:");
+    writeln("    .string \"%ld\\n\"");
+    writeln("    .text");
+    writeln("    .globl main");
+    writeln("main:");
+    writeln("    pushq %rbp");
+    writeln("    movq %rsp, %rbp");
+    for(int r = 0; r < saved_regs(); ++r) {
+        writeln(std::format("    pushq {}", pool[r]));
+    }
+    // Keep %rsp 16 byte aligned for calls
+    int frame_bytes = ((saved_regs() + alloc.num_slots) * 8 + 15) / 16 * 16 - saved_regs() * 8;
+    if(frame_bytes > 0) {
+        writeln(std::format("    subq ${}, %rsp", frame_bytes));
+    }
+    for(size_t i = 0; i < chunk.code.size(); ++i) {
+        if(is_target[i]) {
+            writeln(std::format(".L{}:", i));
+        }
+        asm_gen_instr(chunk.code[i]);
+    }
+    uninitialized_stubs();
+    writeln("    .section .note.GNU-stack,\"\",@progbits");
+    return out;
+}
+
+void AsmGen::asm_gen_instr(const Instr& in) {
+    switch(in.op) {
+        case Op::load_const:
+            if(in_reg(in.a)) {
+                writeln(std::format("    movabsq ${}, {}", chunk.consts[in.b], loc(in.a)));
+            }
+            else {
+                writeln(std::format("    movabsq ${}, %rax", chunk.consts[in.b]));
+                writeln(std::format("    movq %rax, {}", loc(in.a)));
+            }
+            break;
+        case Op::mov:
+            move(loc(in.a), in.b);
+            break;
+        case Op::neg:
+            if(in_reg(in.a)) {
+                move(loc(in.a), in.b);
+                writeln(std::format("    negq {}", loc(in.a)));
+            }
+            else {
+                move("%rax", in.b);
+                writeln("    negq %rax");
+                writeln(std::format("    movq %rax, {}", loc(in.a)));
+            }
+            break;
+        case Op::add:
+        case Op::sub:
+        case Op::mul:
+            biop(in);
+            break;
+        case Op::div:
+            move("%rax", in.b);
+            writeln("    cqto");
+            writeln(std::format("    idivq {}", loc(in.c)));
+            move(loc(in.a), "%rax");
+            break;
+        case Op::jmp:
+            writeln(std::format("    jmp .L{}", in.a));
+            break;
+        case Op::jnz:
+            writeln(std::format("    cmpq $0, {}", loc(in.a)));
+            writeln(std::format("    jne .L{}", in.b));
+            break;
+        case Op::print:
+            print(in.a);
+            break;
+        case Op::check:
+            check(in.a, in.b);
+            break;
+        case Op::halt:
+            writeln("    xorl %eax, %eax");
+            writeln(std::format("    leaq {}(%rbp), %rsp", -8 * saved_regs()));
+            for(int r = saved_regs() - 1; r >= 0; --r) {
+                writeln(std::format("    popq {}", pool[r]));
+            }
+            writeln("    popq %rbp");
+            writeln("    ret");
+            break;
+    }
+}
+
+void AsmGen::biop(const Instr& in) {
+    string mnemonic = in.op == Op::add ? "addq" : in.op == Op::sub ? "subq" : "imulq";
+    bool commutes = in.op != Op::sub;
+    string dst = loc(in.a);
+    if(in_reg(in.a) && dst != loc(in.c)) {
+        move(dst, in.b);
+        writeln(std::format("    {} {}, {}", mnemonic, loc(in.c), dst));
+    }
+    else if(in_reg(in.a) && commutes) {
+        writeln(std::format("    {} {}, {}", mnemonic, loc(in.b), dst));
+    }
+    else {
+        move("%rax", in.b);
+        writeln(std::format("    {} {}, %rax", mnemonic, loc(in.c)));
+        move(dst, "%rax");
+    }
+}
+
+void AsmGen::print(int32_t vreg) {
+    int first = num_callee_saved;
+    int last = std::max(alloc.num_regs, first);
+    bool pad = (last - first) % 2 != 0;
+    for(int r = first; r < last; ++r) {
+        writeln(std::format("    pushq {}", pool[r]));
+    }
+    if(pad) {
+        writeln("    subq $8, %rsp");
+    }
+    move("%rsi", vreg);
+    writeln("    leaq .Lprint_fmt(%rip), %rdi");
+    writeln("    xorl %eax, %eax");
+    writeln("    call printf@PLT");
+    // Flushed like Eval's endl, so a later division by zero can't lose it
+    writeln("    xorl %edi, %edi");
+    writeln("    call fflush@PLT");
+    if(pad) {
+        writeln("    addq $8, %rsp");
+    }
+    for(int r = last - 1; r >= first; --r) {
+        writeln(std::format("    popq {}", pool[r]));
+    }
+}
+
+void AsmGen::check(int32_t vreg, SymId sym) {
+    if(std::find(checked_syms.begin(), checked_syms.end(), sym) == checked_syms.end()) {
+        checked_syms.push_back(sym);
+    }
+    writeln(std::format("    cmpq $0, {}", loc(vreg)));
+    writeln(std::format("    je .Luninit{}", sym));
+}
+
+// Checks jump here from the body of main, where %rsp is aligned for calls.
+// exit flushes what printf buffered before the message.
+void AsmGen::uninitialized_stubs() {
+    for(SymId sym : checked_syms) {
+        writeln(std::format(".Luninit{}:", sym));
+        writeln(std::format("    leaq .Luninit_msg{}(%rip), %rdi", sym));
+        writeln("    call puts@PLT");
+        writeln("    movl $9, %edi");
+        writeln("    call exit@PLT");
+    }
+    if(!checked_syms.empty()) {
+        writeln("    .section .rodata");
+    }
+    for(SymId sym : checked_syms) {
+        writeln(std::format(".Luninit_msg{}:", sym));
+        writeln(std::format("    .string \"symbol '{}' has not been initialized\"", names.name(sym)));
+    }
+}
+
+void AsmGen::move(string dst, int32_t vreg) {
+    if(!in_reg(vreg) && dst.front() != '%') {
+        writeln(std::format("    movq {}, %rax", loc(vreg)));
+        move(dst, "%rax");
+        return;
+    }
+    move(dst, loc(vreg));
+}
+
+void AsmGen::move(string dst, string src) {
+    if(dst != src) {
+        writeln(std::format("    movq {}, {}", src, dst));
+    }
+}
+
+string AsmGen::loc(int32_t vreg) {
+    if(alloc.reg[vreg] >= 0) {
+        return pool[alloc.reg[vreg]];
+    }
+    if(alloc.slot[vreg] >= 0) {
+        return std::format("{}(%rbp)", -8 * (saved_regs() + 1 + alloc.slot[vreg]));
+    }
+    return "%rax";
+}
+
+void AsmGen::writeln(string s) {
+    out += s;
+    out += '\n';
+}
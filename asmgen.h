@@ -0,0 +1,63 @@
+#pragma once
+#include "gavcc.h"
+#include "bytecode.h"
+#include "regalloc.h"
+
+// Lowers a Chunk to x86-64 GNU assembly (AT&T syntax) for a standalone
+// main, with every virtual register wherever LinearScan put it: one of
+// the registers in pool, or a spill slot below the saved registers.
+// Instructions with a spilled destination go through %rax. Op::print
+// calls printf and flushes like Eval does, and a failed Op::check jumps to a stub that
+// prints Eval's error and exits with its code.
+class AsmGen {
+    const Chunk& chunk;
+    const RegAlloc& alloc;
+    const Interner& names;
+    string out;
+    // Symbols with a stub, in the order their first check appears
+    vector<SymId> checked_syms;
+    // Callee saved registers come first so short programs never need to
+    // save anything around printf. %rax and %rdx are left out since idiv
+    // uses them, which also makes them free scratch registers.
+    static constexpr const char* pool[] = {
+        "%rbx", "%r12", "%r13", "%r14", "%r15",
+        "%rcx", "%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11",
+    };
+    static constexpr int num_callee_saved = 5;
+
+public:
+    static constexpr int32_t pool_size = std::size(pool);
+
+    AsmGen(const Chunk& chunk, const RegAlloc& alloc, const Interner& names);
+
+    string asm_gen();
+
+private:
+    void asm_gen_instr(const Instr& in);
+
+    // add, sub and mul: work in place when the destination is a register
+    // that doesn't hold the right operand, otherwise go through %rax
+    void biop(const Instr& in);
+
+    // printf may clobber any caller saved register, so save the ones the
+    // allocation uses. The value goes into %rsi before %rdi is overwritten.
+    void print(int32_t vreg);
+    void check(int32_t vreg, SymId sym);
+    void uninitialized_stubs();
+    void move(string dst, int32_t vreg);
+    void move(string dst, string src);
+
+    // Callee saved registers the allocation uses
+    int saved_regs() {
+        return std::min(alloc.num_regs, num_callee_saved);
+    }
+
+    bool in_reg(int32_t vreg) {
+        return alloc.reg[vreg] >= 0;
+    }
+
+    // Registers LinearScan gave nothing are never live, so any register
+    // will do for them
+    string loc(int32_t vreg);
+    void writeln(string s);
+};
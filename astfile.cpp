@@ -0,0 +1,430 @@
+#include "astfile.h"
+#include <cstring>
+#include <format>
+#include <fstream>
+
+using i64 = int64_t;
+using std::cout;
+using std::endl;
+using nt = NodeType;
+
+[[noreturn]]
+void ast_file_error(string msg) {
+    cout << msg << endl;
+    exit(16);
+}
+
+bool is_biop(NodeType type) {
+    return type == nt::biop_plus || type == nt::biop_minus || type == nt::biop_mul || type == nt::biop_div;
+}
+
+bool is_stmt(NodeType type) {
+    return type == nt::prgm || type == nt::block || type == nt::stmt_decl || type == nt::stmt_assn
+        || type == nt::stmt_return || type == nt::stmt_while;
+}
+
+// Flattens a checked AST in post order and returns the file contents
+class AstWriter {
+    Node* ast;
+    const Interner& names;
+    vector<FlatNode> nodes;
+    vector<uint32_t> children;
+    // Indexes of written nodes whose parent isn't yet, see flatten
+    vector<uint32_t> done;
+
+public:
+    AstWriter(Node* ast, const Interner& names): ast(ast), names(names) {}
+
+    string write() {
+        uint32_t root = flatten(ast);
+        vector<uint32_t> name_offsets;
+        string name_bytes;
+        for(size_t id = 0; id < names.size(); ++id) {
+            name_offsets.push_back(name_bytes.size());
+            name_bytes += names.name(id);
+        }
+        name_offsets.push_back(name_bytes.size());
+
+        AstFileHeader header = {};
+        memcpy(header.magic, ast_file_magic, sizeof(header.magic));
+        header.version = ast_file_version;
+        header.node_count = nodes.size();
+        header.child_count = children.size();
+        header.name_count = names.size();
+        header.name_bytes = name_bytes.size();
+        header.frame_size = ast->frame_size;
+        header.root = root;
+
+        string out;
+        append(out, &header, sizeof(header));
+        append(out, nodes.data(), nodes.size() * sizeof(FlatNode));
+        append(out, children.data(), children.size() * sizeof(uint32_t));
+        append(out, name_offsets.data(), name_offsets.size() * sizeof(uint32_t));
+        out += name_bytes;
+        return out;
+    }
+
+private:
+    // Post order with an explicit stack: a node is visited once to queue
+    // its children, first child on top, and again to write it once their
+    // indexes are on done, in order
+    uint32_t flatten(Node* root) {
+        struct Task {
+            Node* node;
+            bool ready;
+        };
+        vector<Task> pending = { { root, false } };
+        while(!pending.empty()) {
+            Task task = pending.back();
+            pending.pop_back();
+            Node* cur = task.node;
+            nt type = cur->type;
+            if(!task.ready) {
+                pending.push_back({ cur, true });
+                if(type == nt::prgm || type == nt::block) {
+                    for(size_t i = cur->stmts.size(); i-- > 0;) {
+                        pending.push_back({ cur->stmts[i], false });
+                    }
+                }
+                else if(type == nt::stmt_while) {
+                    pending.push_back({ cur->body, false });
+                    pending.push_back({ cur->expr, false });
+                }
+                else if(is_biop(type)) {
+                    pending.push_back({ cur->right, false });
+                    pending.push_back({ cur->left, false });
+                }
+                else if(type != nt::stmt_decl && type != nt::lit_id && type != nt::lit_int) {
+                    pending.push_back({ cur->expr, false });
+                }
+                continue;
+            }
+
+            FlatNode flat = { .type = type, .slot = cur->slot, .a = 0, .b = 0 };
+            if(type == nt::prgm || type == nt::block) {
+                size_t count = cur->stmts.size();
+                flat.a = children.size();
+                flat.b = count;
+                children.insert(children.end(), done.end() - count, done.end());
+                done.resize(done.size() - count);
+            }
+            else if(type == nt::stmt_while || is_biop(type)) {
+                flat.b = pop_done();
+                flat.a = pop_done();
+            }
+            else if(type == nt::stmt_assn) {
+                flat.a = pop_done();
+                flat.b = cur->sym;
+            }
+            else if(type == nt::stmt_decl || type == nt::lit_id) {
+                flat.b = cur->sym;
+            }
+            else if(type == nt::lit_int) {
+                flat.a = (uint64_t)cur->ival;
+                flat.b = (uint64_t)cur->ival >> 32;
+            }
+            else {
+                flat.a = pop_done();
+            }
+            nodes.push_back(flat);
+            done.push_back(nodes.size() - 1);
+        }
+        return pop_done();
+    }
+
+    uint32_t pop_done() {
+        uint32_t index = done.back();
+        done.pop_back();
+        return index;
+    }
+
+    static void append(string& out, const void* data, size_t size) {
+        out.append(static_cast<const char*>(data), size);
+    }
+};
+
+AstFile::AstFile(const string& filename): source(filename) {
+    std::string_view data = source.text();
+    if(data.size() < sizeof(AstFileHeader) || memcmp(data.data(), ast_file_magic, sizeof(ast_file_magic)) != 0) {
+        ast_file_error(std::format("{} is not an AST file", filename));
+    }
+    if(reinterpret_cast<uintptr_t>(data.data()) % alignof(FlatNode) != 0) {
+        ast_file_error(std::format("{} is not aligned in memory", filename));
+    }
+    header = reinterpret_cast<const AstFileHeader*>(data.data());
+    if(header->version != ast_file_version) {
+        ast_file_error(std::format("{} has AST format version {}, expected {}", filename, header->version, ast_file_version));
+    }
+    uint64_t size = sizeof(AstFileHeader)
+        + (uint64_t)header->node_count * sizeof(FlatNode)
+        + (uint64_t)header->child_count * sizeof(uint32_t)
+        + ((uint64_t)header->name_count + 1) * sizeof(uint32_t)
+        + header->name_bytes;
+    if(size != data.size()) {
+        ast_file_error(std::format("{} is truncated or has trailing bytes", filename));
+    }
+    nodes = reinterpret_cast<const FlatNode*>(header + 1);
+    children = reinterpret_cast<const uint32_t*>(nodes + header->node_count);
+    name_offsets = children + header->child_count;
+    name_bytes = reinterpret_cast<const char*>(name_offsets + header->name_count + 1);
+    validate(filename);
+}
+
+void AstFile::validate(const string& filename) {
+    auto bad = [&](string what) {
+        ast_file_error(std::format("{} is corrupt: {}", filename, what));
+    };
+    if(header->node_count == 0 || header->root >= header->node_count || header->frame_size < 0) {
+        bad("bad header");
+    }
+    for(uint32_t i = 0; i <= header->name_count; ++i) {
+        if(name_offsets[i] > header->name_bytes || (i > 0 && name_offsets[i] < name_offsets[i - 1])) {
+            bad("bad name table");
+        }
+    }
+    starts.resize(header->node_count);
+    for(uint32_t i = 0; i < header->node_count; ++i) {
+        const FlatNode& cur = nodes[i];
+        nt type = cur.type;
+        if(type < nt::prgm || type > nt::lit_id) {
+            bad(std::format("node {} has an unknown type", i));
+        }
+
+        uint32_t pair[2] = { cur.a, cur.b };
+        std::span<const uint32_t> kids;
+        if(type == nt::prgm || type == nt::block) {
+            if((uint64_t)cur.stmts_start() + cur.stmts_count() > header->child_count) {
+                bad(std::format("node {} has statements out of range", i));
+            }
+            kids = stmts(cur);
+        }
+        else if(type == nt::stmt_while || is_biop(type)) {
+            kids = pair;
+        }
+        else if(type == nt::stmt_assn || type == nt::stmt_return || type == nt::paren_group
+            || type == nt::unary_plus || type == nt::unary_minus) {
+            kids = std::span(pair, 1);
+        }
+        // The last child's subtree ends right before this node, and each
+        // earlier one right before the next one's starts. Only the
+        // statements of a block and a loop's body are statements.
+        uint32_t end = i;
+        for(size_t k = kids.size(); k-- > 0;) {
+            uint32_t child = kids[k];
+            bool stmt = type == nt::prgm || type == nt::block || (type == nt::stmt_while && k == 1);
+            if(end == 0 || child != end - 1 || is_stmt(nodes[child].type) != stmt) {
+                bad(std::format("node {} has a bad child", i));
+            }
+            end = starts[child];
+        }
+        starts[i] = end;
+
+        if(type == nt::stmt_decl || type == nt::stmt_assn || type == nt::lit_id) {
+            if(cur.sym() >= header->name_count || cur.slot < 0 || cur.slot >= header->frame_size) {
+                bad(std::format("node {} has a bad symbol or slot", i));
+            }
+        }
+    }
+    if(!is_stmt(nodes[header->root].type)) {
+        bad("root is not a statement");
+    }
+}
+
+void write_ast_file(const string& filename, Node* ast, const Interner& names) {
+    string data = AstWriter(ast, names).write();
+    std::ofstream file(filename, std::ios::binary);
+    file.write(data.data(), data.size());
+    if(!file) {
+        ast_file_error(std::format("Failed to write {}", filename));
+    }
+}
+
+void FlatEval::eval() {
+    exec(file.root());
+    while(!open_stmts.empty()) {
+        OpenStmt& top = open_stmts.back();
+        const FlatNode& cur = file.node(top.index);
+        if(cur.type == nt::stmt_while) {
+            if(!eval_expr(cur.expr())) {
+                open_stmts.pop_back();
+                continue;
+            }
+            exec(cur.body());
+        }
+        else if(top.next < cur.stmts_count()) {
+            exec(file.stmts(cur)[top.next++]);
+        }
+        else {
+            open_stmts.pop_back();
+        }
+    }
+}
+
+// Runs a simple statement, or opens a block or loop for eval to step through
+void FlatEval::exec(uint32_t index) {
+    const FlatNode& cur = file.node(index);
+    switch(cur.type) {
+        case nt::stmt_decl:
+            frame.decl(cur.slot);
+            break;
+        case nt::stmt_assn:
+            frame.assn(cur.slot, eval_expr(cur.expr()));
+            break;
+        case nt::stmt_return:
+            cout << eval_expr(cur.expr()) << endl;
+            break;
+        default:
+            // prgm, block or stmt_while
+            open_stmts.push_back({ index, 0 });
+    }
+}
+
+// Operands come before their operator, the left one first, so reads are
+// in the order Eval makes them
+i64 FlatEval::eval_expr(uint32_t index) {
+    values.clear();
+    for(uint32_t i = file.subtree_start(index); i <= index; ++i) {
+        const FlatNode& cur = file.node(i);
+        switch(cur.type) {
+            case nt::lit_int:
+                values.push_back(cur.ival());
+                break;
+            case nt::lit_id:
+                if(!frame.is_initialized(cur.slot)) {
+                    cout << std::format("symbol '{}' has not been initialized", file.name(cur.sym())) << endl;
+                    exit(9);
+                }
+                values.push_back(frame.get(cur.slot));
+                break;
+            case nt::unary_minus:
+                values.back() = -values.back();
+                break;
+            case nt::biop_plus:
+            case nt::biop_minus:
+            case nt::biop_mul:
+            case nt::biop_div: {
+                i64 right = values.back();
+                values.pop_back();
+                i64& left = values.back();
+                if(cur.type == nt::biop_plus) {
+                    left = left + right;
+                }
+                else if(cur.type == nt::biop_minus) {
+                    left = left - right;
+                }
+                else if(cur.type == nt::biop_mul) {
+                    left = left * right;
+                }
+                else {
+                    left = left / right;
+                }
+                break;
+            }
+            default:
+                // paren_group and unary_plus pass their operand through
+                break;
+        }
+    }
+    return values.back();
+}
+
+// The same walk as to_string::node's NodePrinter, over flat nodes: a task
+// is a node, or a label line, at some depth below indent
+class FlatPrinter {
+    struct Task {
+        uint32_t index;
+        size_t depth;
+        const char* label;
+    };
+    const AstFile& file;
+    const string& indent;
+    vector<Task> pending;
+    string s;
+
+public:
+    FlatPrinter(const AstFile& file, const string& indent): file(file), indent(indent) {}
+
+    string print(uint32_t root) {
+        pending.push_back({ root, 0, nullptr });
+        while(!pending.empty()) {
+            Task task = pending.back();
+            pending.pop_back();
+            start_line(task.depth);
+            if(task.label) {
+                s += task.label;
+                s += "\n";
+                continue;
+            }
+            line(task.index, task.depth + 1);
+        }
+        return std::move(s);
+    }
+
+private:
+    void start_line(size_t depth) {
+        s += indent;
+        s.append(depth * 4, ' ');
+    }
+
+    // Finishes the node's line and queues what goes below it, last first
+    void line(uint32_t index, size_t child) {
+        const FlatNode& node = file.node(index);
+        NodeType type = node.type;
+        s += to_string::node_type(type) + ": ";
+        if(type == nt::lit_int) {
+            s += std::to_string(node.ival()) + "\n";
+            return;
+        }
+        if(type == nt::lit_id) {
+            s += string(file.name(node.sym())) + "\n";
+            return;
+        }
+        s += "\n";
+        switch(type) {
+            case nt::prgm:
+            case nt::block: {
+                std::span<const uint32_t> stmts = file.stmts(node);
+                for(size_t i = stmts.size(); i-- > 0;) {
+                    pending.push_back({ stmts[i], child, nullptr });
+                }
+                break;
+            }
+            case nt::stmt_decl:
+                start_line(child);
+                s += "name: " + string(file.name(node.sym())) + "\n";
+                break;
+            case nt::stmt_assn:
+                start_line(child);
+                s += "name: " + string(file.name(node.sym())) + "\n";
+                pending.push_back({ node.expr(), child + 1, nullptr });
+                pending.push_back({ 0, child, "expr:" });
+                break;
+            case nt::stmt_return:
+                pending.push_back({ node.expr(), child + 1, nullptr });
+                pending.push_back({ 0, child, "expr:" });
+                break;
+            case nt::stmt_while:
+                pending.push_back({ node.body(), child + 1, nullptr });
+                pending.push_back({ 0, child + 1, "stmts:" });
+                pending.push_back({ node.expr(), child + 1, nullptr });
+                pending.push_back({ 0, child, "while:" });
+                break;
+            case nt::biop_plus:
+            case nt::biop_minus:
+            case nt::biop_mul:
+            case nt::biop_div:
+                pending.push_back({ node.right(), child, nullptr });
+                pending.push_back({ node.left(), child, nullptr });
+                break;
+            default:
+                // paren_group and unary_*
+                pending.push_back({ node.expr(), child, nullptr });
+        }
+    }
+};
+
+namespace to_string {
+    string flat_node(const AstFile& file, uint32_t index, string indent) {
+        return FlatPrinter(file, indent).print(index);
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "gavcc.h"
+#include "eval.h"
+#include "source.h"
+
+// Binary form of a checked AST, laid out so a mapped file can be used in
+// place. Every section is an array of fixed size records:
+//
+//   AstFileHeader
+//   FlatNode[node_count]       in post order, each node right after the
+//                              subtrees of its children, in order
+//   uint32_t[child_count]      node indexes for the stmts of prgm and block
+//   uint32_t[name_count + 1]   offsets of each name in the name bytes
+//   char[name_bytes]           the Interner's names, back to back
+//
+// Integers are stored in host byte order. Bump version whenever the
+// layout or the meaning of a field changes.
+constexpr char ast_file_magic[4] = { 'G', 'A', 'S', 'T' };
+constexpr uint32_t ast_file_version = 1;
+
+struct AstFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t child_count;
+    uint32_t name_count;
+    uint32_t name_bytes;
+    int32_t frame_size;
+    uint32_t root;
+};
+
+// A Node with its pointers replaced by node indexes, packed into 16 bytes
+// by only keeping the fields its type uses:
+//
+//   prgm, block                  a = first child, b = number of children
+//   stmt_while                   a = expr, b = body
+//   biop_*                       a = left, b = right
+//   stmt_return, paren_group,
+//   unary_*                      a = expr
+//   stmt_assn                    a = expr, b = sym
+//   stmt_decl, lit_id            b = sym
+//   lit_int                      a, b = low and high half of ival
+struct FlatNode {
+    NodeType type;
+    int32_t slot;
+    uint32_t a;
+    uint32_t b;
+
+    uint32_t stmts_start() const { return a; }
+    uint32_t stmts_count() const { return b; }
+    uint32_t expr() const { return a; }
+    uint32_t body() const { return b; }
+    uint32_t left() const { return a; }
+    uint32_t right() const { return b; }
+    SymId sym() const { return b; }
+    int64_t ival() const { return (int64_t)((uint64_t)b << 32 | a); }
+};
+
+static_assert(sizeof(AstFileHeader) % alignof(FlatNode) == 0);
+static_assert(sizeof(FlatNode) == 16);
+
+// A mapped AST file. Everything is checked once on load, the rest is
+// array indexing: the nodes are in post order, so every subtree is a run
+// of nodes ending at its root and walks always terminate, statements and
+// expressions are where they belong, and every slot fits the frame.
+class AstFile {
+    SourceFile source;
+    const AstFileHeader* header;
+    const FlatNode* nodes;
+    const uint32_t* children;
+    const uint32_t* name_offsets;
+    const char* name_bytes;
+    // First node of each node's subtree, found by validate
+    vector<uint32_t> starts;
+
+public:
+    AstFile(const string& filename);
+
+    uint32_t root() const {
+        return header->root;
+    }
+
+    int32_t frame_size() const {
+        return header->frame_size;
+    }
+
+    const FlatNode& node(uint32_t index) const {
+        return nodes[index];
+    }
+
+    uint32_t subtree_start(uint32_t index) const {
+        return starts[index];
+    }
+
+    std::span<const uint32_t> stmts(const FlatNode& node) const {
+        return { children + node.stmts_start(), node.stmts_count() };
+    }
+
+    std::string_view name(SymId id) const {
+        return { name_bytes + name_offsets[id], name_offsets[id + 1] - name_offsets[id] };
+    }
+
+private:
+    void validate(const string& filename);
+};
+
+void write_ast_file(const string& filename, Node* ast, const Interner& names);
+
+// Eval for a mapped AstFile, running straight off the flat nodes. Like
+// Eval, blocks and loops nest through a stack instead of the call stack.
+// An expression is one pass over its subtree's nodes, which post order
+// puts operands before their operator.
+class FlatEval {
+    const AstFile& file;
+    Frame frame;
+    // Blocks and loops being run, innermost last, with the next statement
+    // of a block
+    struct OpenStmt {
+        uint32_t index;
+        uint32_t next;
+    };
+    vector<OpenStmt> open_stmts;
+    // Operands of eval_expr
+    vector<int64_t> values;
+
+public:
+    FlatEval(const AstFile& file): file(file), frame(file.frame_size()) {}
+
+    void eval();
+
+private:
+    void exec(uint32_t index);
+    int64_t eval_expr(uint32_t index);
+};
+
+namespace to_string {
+    // Same text as to_string::node gives for the tree the file came from
+    string flat_node(const AstFile& file, uint32_t index, string indent = "");
+}
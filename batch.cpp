@@ -0,0 +1,79 @@
+#include "batch.h"
+#include "codegen.h"
+#include "output.h"
+#include "fold.h"
+#include "parser.h"
+#include "semanal.h"
+#include "source.h"
+#include <fstream>
+
+BatchResult compile_text(std::string_view text, bool fold) {
+    try {
+        Interner names;
+        Scanner scanner(text, names);
+        Arena arena;
+        Parser parser(scanner, arena);
+        Node* ast = parser.parse();
+        SemAnal sem_anal(ast, names);
+        sem_anal.sem_anal();
+        if(fold) {
+            Fold(ast).fold();
+        }
+        string output;
+        OutputSink sink(output);
+        CodeGen(ast, names, sink).code_gen();
+        sink.flush();
+        return { std::move(output), 0 };
+    }
+    catch(const CompileError& error) {
+        return { error.msg + "\n", error.code };
+    }
+}
+
+BatchResult compile_file(const string& path, bool fold, CompileCache* cache) {
+    throw_compile_errors = true;
+    try {
+        SourceFile source(path);
+        std::string_view text = source.text();
+        uint64_t key = 0;
+        if(cache) {
+            key = CompileCache::key(text, fold ? "fold" : "");
+            BatchResult cached;
+            if(cache->load(key, text.size(), cached.output, cached.code)) {
+                return cached;
+            }
+        }
+        BatchResult result = compile_text(text, fold);
+        if(cache) {
+            cache->store(key, text.size(), result.output, result.code);
+        }
+        return result;
+    }
+    catch(const std::exception& error) {
+        return { string(error.what()) + "\n", 1 };
+    }
+}
+
+vector<BatchResult> compile_batch(const vector<string>& paths, size_t num_threads, bool fold, CompileCache* cache) {
+    vector<BatchResult> results(paths.size());
+    WorkStealingPool pool(num_threads);
+    pool.run(paths.size(), [&](size_t i) {
+        results[i] = compile_file(paths[i], fold, cache);
+    });
+    return results;
+}
+
+vector<string> read_manifest(const string& filename) {
+    std::ifstream file(filename);
+    if(!file) {
+        throw std::runtime_error("Failed to open manifest: " + filename);
+    }
+    vector<string> paths;
+    string line;
+    while(std::getline(file, line)) {
+        if(!line.empty()) {
+            paths.push_back(line);
+        }
+    }
+    return paths;
+}
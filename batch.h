@@ -0,0 +1,89 @@
+#pragma once
+#include "gavcc.h"
+#include "cache.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Runs a fixed set of tasks, numbered 0 to count - 1, on a number of
+// threads. Each thread starts with its own contiguous share of the tasks
+// and takes them from the front of its deque. A thread that runs out
+// steals from the back of another thread's deque, so a few slow tasks
+// don't leave the other threads idle.
+class WorkStealingPool {
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+    size_t num_threads;
+
+public:
+    WorkStealingPool(size_t num_threads): num_threads(num_threads ? num_threads : 1) {}
+
+    // Returns once every task has run
+    template <typename F>
+    void run(size_t count, F task) {
+        vector<Queue> queues(num_threads);
+        for(size_t i = 0; i < count; ++i) {
+            queues[i * num_threads / count].tasks.push_back(i);
+        }
+        vector<std::jthread> threads;
+        for(size_t self = 0; self < num_threads; ++self) {
+            threads.emplace_back([&, self] {
+                size_t index;
+                while(pop(queues[self], index) || steal(queues, self, index)) {
+                    task(index);
+                }
+            });
+        }
+    }
+
+private:
+    static bool pop(Queue& queue, size_t& index) {
+        std::lock_guard guard(queue.lock);
+        if(queue.tasks.empty()) {
+            return false;
+        }
+        index = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    // No tasks are added while running, so once every queue is empty the
+    // thread is done
+    static bool steal(vector<Queue>& queues, size_t self, size_t& index) {
+        for(size_t i = 1; i < queues.size(); ++i) {
+            Queue& victim = queues[(self + i) % queues.size()];
+            std::lock_guard guard(victim.lock);
+            if(!victim.tasks.empty()) {
+                index = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+struct BatchResult {
+    // CodeGen output, or the error message if the file didn't compile
+    string output;
+    // The exit code the single file driver would have stopped with
+    int code = 0;
+};
+
+// Source text through Scanner, Parser, SemAnal, optionally Fold, and
+// CodeGen. Everything a compile touches is created here, so files share
+// nothing.
+BatchResult compile_text(std::string_view text, bool fold);
+
+// With a cache, a hit goes straight from reading the file to the result.
+// Files that can't be read are never cached.
+BatchResult compile_file(const string& path, bool fold, CompileCache* cache);
+
+// Results come back in the order of paths, however the files were
+// scheduled
+vector<BatchResult> compile_batch(const vector<string>& paths, size_t num_threads, bool fold, CompileCache* cache = nullptr);
+
+// One path per line, blank lines are skipped
+vector<string> read_manifest(const string& filename);
@@ -0,0 +1,414 @@
+#include "gavcc.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#include "source.h"
+#include "scanner.h"
+#include "parser.h"
+#include "semanal.h"
+#include "fold.h"
+#include "codegen.h"
+#include "output.h"
+#include "eval.h"
+#include "closure.h"
+#include "bytecode.h"
+
+using std::cout;
+using std::endl;
+
+// Benchmark harness: times each phase of the pipeline on every input file
+// and reports its throughput.
+//
+//   scan     MB of source per second
+//   scan-*   the same with the scalar, SSE2 and AVX2 span kernels, each
+//            checked to give the scalar scan's tokens first
+//   parse    AST nodes per second, including the scanning the parser
+//            pulls on demand
+//   semanal  time per run
+//   codegen  MB of C per second
+//   eval     AST nodes evaluated per second
+//   jit      the same for --exec=jit with a low threshold, the loops
+//            compiled by the warmup run
+//   closure  the same for --exec=closure, not counting compiling the
+//            closures
+//   bytecode the same for --exec=bytecode, not counting lowering to
+//            bytecode
+//
+// Each phase is warmed up once, then timed --reps times. Fast phases are
+// run several times per sample so no sample is shorter than a
+// millisecond or two, which keeps timer resolution out of the results.
+// The table shows the median and the 95% confidence interval of the mean.
+//
+// --save=FILE writes the raw statistics, and --baseline=FILE compares
+// against a saved run with Welch's t-test. Only differences the test
+// calls significant are labeled faster or slower.
+
+// Summary of the seconds per run of one phase
+struct Stats {
+    size_t n = 0;
+    double mean = 0;
+    double stddev = 0;
+    double median = 0;
+
+    static Stats of(vector<double> samples) {
+        Stats stats;
+        stats.n = samples.size();
+        for(double s : samples) {
+            stats.mean += s;
+        }
+        stats.mean /= stats.n;
+        for(double s : samples) {
+            stats.stddev += (s - stats.mean) * (s - stats.mean);
+        }
+        stats.stddev = stats.n > 1 ? std::sqrt(stats.stddev / (stats.n - 1)) : 0;
+        std::sort(samples.begin(), samples.end());
+        stats.median = stats.n % 2 ? samples[stats.n / 2] : (samples[stats.n / 2 - 1] + samples[stats.n / 2]) / 2;
+        return stats;
+    }
+
+    // Half width of the 95% confidence interval of the mean, relative to it
+    double ci95() const {
+        return n > 1 ? t_critical(n - 1) * stddev / std::sqrt((double)n) / mean : 0;
+    }
+
+    // Two sided 95% critical value of Student's t
+    static double t_critical(double df) {
+        static constexpr double table[] = {
+            12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+            2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+            2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+        };
+        size_t i = (size_t)std::floor(df);
+        return i < 1 ? table[0] : i <= std::size(table) ? table[i - 1] : 1.96;
+    }
+};
+
+// What a phase processed per run, to turn time into a rate
+struct Work {
+    double amount;
+    // Display name of the rate, amount / seconds
+    const char* unit;
+    double scale = 1;
+};
+
+struct BenchResult {
+    string input;
+    string phase;
+    Stats stats;
+    Work work;
+};
+
+// The AST nodes an Eval of cur visits. A second, minimal evaluator, run
+// once before timing so Eval itself carries no counter.
+class OpCounter {
+    vector<int64_t> frame;
+    uint64_t ops = 0;
+
+public:
+    OpCounter(Node* ast): frame(ast->frame_size) {}
+
+    uint64_t count(Node* ast) {
+        eval(ast);
+        return ops;
+    }
+
+private:
+    int64_t eval(Node* cur) {
+        ++ops;
+        switch(cur->type) {
+            case NodeType::prgm:
+            case NodeType::block:
+                for(Node* stmt : cur->stmts) {
+                    eval(stmt);
+                }
+                return 0;
+            case NodeType::stmt_while:
+                while(eval(cur->expr)) {
+                    eval(cur->body);
+                }
+                return 0;
+            case NodeType::stmt_decl:
+                return 0;
+            case NodeType::stmt_assn:
+                frame[cur->slot] = eval(cur->expr);
+                return 0;
+            case NodeType::stmt_return:
+            case NodeType::paren_group:
+            case NodeType::unary_plus:
+                return eval(cur->expr);
+            case NodeType::unary_minus:
+                return -eval(cur->expr);
+            case NodeType::biop_plus:
+                return eval(cur->left) + eval(cur->right);
+            case NodeType::biop_minus:
+                return eval(cur->left) - eval(cur->right);
+            case NodeType::biop_mul:
+                return eval(cur->left) * eval(cur->right);
+            case NodeType::biop_div: {
+                int64_t left = eval(cur->left);
+                int64_t right = eval(cur->right);
+                return right ? left / right : 0;
+            }
+            case NodeType::lit_int:
+                return cur->ival;
+            case NodeType::lit_id:
+                return frame[cur->slot];
+        }
+        return 0;
+    }
+};
+
+class Bench {
+    using clock = std::chrono::steady_clock;
+    static constexpr double min_sample_seconds = 0.002;
+    // Low, so loops tier up almost at once and the jit phase is mostly
+    // machine code
+    static constexpr int64_t jit_threshold = 16;
+    int reps;
+    vector<BenchResult> results;
+
+public:
+    Bench(int reps): reps(reps) {}
+
+    void run(const string& path) {
+        string input = path.substr(path.find_last_of('/') + 1);
+        SourceFile source(path);
+        std::string_view text = source.text();
+        double megabytes = text.size() / 1e6;
+
+        measure(input, "scan", { megabytes, "MB/s" }, [&] {
+            Interner names;
+            return Scanner(text, names).scan().size();
+        });
+
+        // Each span kernel width scan can pick, once it is known to give
+        // the same tokens as the scalar one
+        check_scan_widths(input, text);
+        for(auto [simd, phase] : scan_widths) {
+            if(simd > char_span::best()) {
+                continue;
+            }
+            measure(input, phase, { megabytes, "MB/s" }, [&] {
+                Interner names;
+                return Scanner(text, names, simd).scan().size();
+            });
+        }
+
+        // One tree for the later phases. SemAnal fills in the same slots
+        // every run, and its warmup run does so before the others time
+        // anything.
+        Interner names;
+        Scanner scanner(text, names);
+        Arena arena;
+        Parser parser(scanner, arena);
+        Node* ast = parser.parse();
+        size_t nodes = count_nodes(ast);
+
+        measure(input, "parse", { (double)nodes, "Mnodes/s", 1e-6 }, [&] {
+            Interner names;
+            Scanner scanner(text, names);
+            Arena arena;
+            Parser parser(scanner, arena);
+            return parser.parse() != nullptr;
+        });
+
+        measure(input, "semanal", { 1, "runs/s" }, [&] {
+            SemAnal sem_anal(ast, names);
+            sem_anal.sem_anal();
+            return ast->frame_size;
+        });
+
+        // Into a sink that discards it, so only generating it is timed
+        OutputSink counter;
+        CodeGen(ast, names, counter).code_gen();
+        double output_megabytes = counter.size() / 1e6;
+        measure(input, "codegen", { output_megabytes, "MB/s" }, [&] {
+            OutputSink sink;
+            CodeGen(ast, names, sink).code_gen();
+            return sink.size();
+        });
+
+        // The program's prints would only add noise
+        double ops = OpCounter(ast).count(ast);
+        std::streambuf* cout_buf = cout.rdbuf(nullptr);
+        measure(input, "eval", { ops, "Mops/s", 1e-6 }, [&] {
+            Eval eval(ast, names);
+            return eval.eval();
+        });
+        // Compiled loops stay in jit across runs, so after the warmup
+        // this times running them rather than compiling them
+        Jit jit(jit_threshold);
+        measure(input, "jit", { ops, "Mops/s", 1e-6 }, [&] {
+            Eval eval(ast, names, &jit);
+            return eval.eval();
+        });
+        ClosureGen closure_gen(ast);
+        const ClosureStmt* program = closure_gen.gen();
+        measure(input, "closure", { ops, "Mops/s", 1e-6 }, [&] {
+            ClosureEval closure_eval(program, ast->frame_size, names);
+            return closure_eval.eval();
+        });
+        Chunk chunk = BytecodeGen(ast).gen();
+        measure(input, "bytecode", { ops, "Mops/s", 1e-6 }, [&] {
+            VM vm(chunk, names);
+            vm.run();
+            return chunk.num_regs;
+        });
+        cout.rdbuf(cout_buf);
+        cout.clear();
+    }
+
+    void print(const std::map<string, Stats>& baseline) {
+        cout << std::format("{:<16} {:<11} {:>12} {:<18} {:>6}", "input", "phase", "median", "     rate", "ci95");
+        if(!baseline.empty()) {
+            cout << std::format("  {:>8}  {}", "vs base", "");
+        }
+        cout << endl;
+        for(const BenchResult& result : results) {
+            const Stats& stats = result.stats;
+            double rate = result.work.amount / stats.median * result.work.scale;
+            cout << std::format("{:<16} {:<11} {:>9.3f} ms {:>9.2f} {:<8} {:>5.1f}%",
+                result.input, result.phase, stats.median * 1e3, rate, result.work.unit, stats.ci95() * 100);
+            auto base = baseline.find(result.input + " " + result.phase);
+            if(base != baseline.end()) {
+                cout << "  " << compare(base->second, stats);
+            }
+            cout << endl;
+        }
+    }
+
+    void save(const string& filename) {
+        std::ofstream file(filename);
+        for(const BenchResult& result : results) {
+            const Stats& stats = result.stats;
+            file << std::format("{} {} {} {} {} {}\n", result.input, result.phase, stats.n, stats.mean, stats.stddev, stats.median);
+        }
+    }
+
+    static std::map<string, Stats> load(const string& filename) {
+        std::ifstream file(filename);
+        if(!file) {
+            cout << "Failed to open baseline: " << filename << endl;
+            exit(1);
+        }
+        std::map<string, Stats> baseline;
+        string input, phase;
+        Stats stats;
+        while(file >> input >> phase >> stats.n >> stats.mean >> stats.stddev >> stats.median) {
+            baseline[input + " " + phase] = stats;
+        }
+        return baseline;
+    }
+
+private:
+    static constexpr std::pair<ScanSimd, const char*> scan_widths[] = {
+        { ScanSimd::scalar, "scan-scalar" },
+        { ScanSimd::sse2, "scan-sse2" },
+        { ScanSimd::avx2, "scan-avx2" },
+    };
+
+    // Every width the CPU supports has to give the scalar scan's tokens,
+    // down to their lexemes and interned names
+    static void check_scan_widths(const string& input, std::string_view text) {
+        Interner scalar_names;
+        vector<Token> scalar = Scanner(text, scalar_names, ScanSimd::scalar).scan();
+        for(auto [simd, phase] : scan_widths) {
+            if(simd == ScanSimd::scalar || simd > char_span::best()) {
+                continue;
+            }
+            Interner names;
+            vector<Token> tokens = Scanner(text, names, simd).scan();
+            auto same = [](const Token& a, const Token& b) {
+                return a.type == b.type && a.sym == b.sym && a.ival == b.ival
+                    && a.lexeme.data() == b.lexeme.data() && a.lexeme.size() == b.lexeme.size();
+            };
+            if(!std::equal(tokens.begin(), tokens.end(), scalar.begin(), scalar.end(), same)) {
+                cout << std::format("{}: {} tokens differ from scan-scalar's", input, phase) << endl;
+                exit(1);
+            }
+        }
+    }
+
+    // Warms up, picks how many runs make one sample, then takes reps
+    // samples of the seconds per run
+    template <typename F>
+    void measure(const string& input, const string& phase, Work work, F run) {
+        auto start = clock::now();
+        volatile auto sink = run();
+        double first = std::chrono::duration<double>(clock::now() - start).count();
+        int inner = std::max(1, (int)std::ceil(min_sample_seconds / std::max(first, 1e-9)));
+        vector<double> samples;
+        for(int rep = 0; rep < reps; ++rep) {
+            start = clock::now();
+            for(int i = 0; i < inner; ++i) {
+                sink = run();
+            }
+            samples.push_back(std::chrono::duration<double>(clock::now() - start).count() / inner);
+        }
+        (void)sink;
+        results.push_back({ input, phase, Stats::of(samples), work });
+    }
+
+    // Welch's t-test on the means, with the Welch-Satterthwaite degrees of
+    // freedom. The change is shown as a speedup, base time over current.
+    static string compare(const Stats& base, const Stats& cur) {
+        double speedup = base.mean / cur.mean;
+        double base_var = base.stddev * base.stddev / base.n;
+        double cur_var = cur.stddev * cur.stddev / cur.n;
+        double se = std::sqrt(base_var + cur_var);
+        if(se == 0) {
+            return std::format("{:>7.2f}x", speedup);
+        }
+        double t = (base.mean - cur.mean) / se;
+        double df = (base_var + cur_var) * (base_var + cur_var)
+            / (base_var * base_var / (base.n - 1) + cur_var * cur_var / (cur.n - 1));
+        if(std::abs(t) < Stats::t_critical(df)) {
+            return std::format("{:>7.2f}x  same", speedup);
+        }
+        return std::format("{:>7.2f}x  {}", speedup, speedup > 1 ? "faster" : "slower");
+    }
+};
+
+int main(int argc, char** argv) {
+    int reps = 10;
+    string save;
+    string baseline;
+    vector<string> inputs;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if(arg.starts_with("--reps=")) {
+            reps = std::max(2, std::stoi(arg.substr(string("--reps=").size())));
+        }
+        else if(arg.starts_with("--save=")) {
+            save = arg.substr(string("--save=").size());
+        }
+        else if(arg.starts_with("--baseline=")) {
+            baseline = arg.substr(string("--baseline=").size());
+        }
+        else if(arg.starts_with("--")) {
+            cout << "Unknown option: " << arg << endl;
+            return 1;
+        }
+        else {
+            inputs.push_back(arg);
+        }
+    }
+    std::map<string, Stats> base;
+    if(!baseline.empty()) {
+        base = Bench::load(baseline);
+    }
+    Bench bench(reps);
+    for(const string& input : inputs) {
+        bench.run(input);
+    }
+    bench.print(base);
+    if(!save.empty()) {
+        bench.save(save);
+    }
+    return 0;
+}
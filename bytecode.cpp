@@ -0,0 +1,379 @@
+#include "bytecode.h"
+#include "fold.h"
+#include <format>
+#include <iostream>
+
+using i64 = int64_t;
+using std::cout;
+using std::endl;
+using nt = NodeType;
+
+void bytecode_error(string msg) {
+    cout << msg << endl;
+    exit(13);
+}
+
+// Which reads may see an uninitialized variable. Follows the rule Frame
+// enforces at run time, declarations clear a slot and assignments set it,
+// with a third state for slots that are set on some paths only. A loop's
+// head joins the state on entry with the state after each run of the
+// body, approximated from what the body writes: a slot the body only
+// assigns stays set if it was on entry, any other slot it writes may or
+// may not be.
+class InitAnalysis {
+    enum State : uint8_t {
+        unset,
+        maybe,
+        set,
+    };
+    static constexpr uint8_t assigned = 1;
+    static constexpr uint8_t declared = 2;
+    vector<State> state;
+
+public:
+    // Reads that need a check, and the slots they read
+    std::unordered_set<Node*> checked_reads;
+    vector<bool> tracked;
+
+    InitAnalysis(int32_t frame_size): state(frame_size, unset), tracked(frame_size) {}
+
+    void stmt(Node* cur) {
+        nt type = cur->type;
+        if(type == nt::prgm || type == nt::block) {
+            for(Node* stmt : cur->stmts) {
+                this->stmt(stmt);
+            }
+        }
+        else if(type == nt::stmt_while) {
+            vector<uint8_t> writes(state.size());
+            collect_writes(cur->body, writes);
+            for(size_t slot = 0; slot < state.size(); ++slot) {
+                if(writes[slot] & declared || (writes[slot] && state[slot] != set)) {
+                    state[slot] = maybe;
+                }
+            }
+            // Also the state the loop exits with, from its condition
+            vector<State> head = state;
+            expr(cur->expr);
+            stmt(cur->body);
+            state = std::move(head);
+        }
+        else if(type == nt::stmt_decl) {
+            state[cur->slot] = unset;
+        }
+        else if(type == nt::stmt_assn) {
+            expr(cur->expr);
+            state[cur->slot] = set;
+        }
+        else if(type == nt::stmt_return) {
+            expr(cur->expr);
+        }
+    }
+
+private:
+    void expr(Node* cur) {
+        nt type = cur->type;
+        if(type == nt::lit_id) {
+            if(state[cur->slot] != set) {
+                checked_reads.insert(cur);
+                tracked[cur->slot] = true;
+                // Running on past the check means it was set
+                state[cur->slot] = set;
+            }
+        }
+        else if(type == nt::paren_group || type == nt::unary_plus || type == nt::unary_minus) {
+            expr(cur->expr);
+        }
+        else if(type != nt::lit_int) {
+            expr(cur->left);
+            expr(cur->right);
+        }
+    }
+
+    void collect_writes(Node* cur, vector<uint8_t>& writes) {
+        nt type = cur->type;
+        if(type == nt::block) {
+            for(Node* stmt : cur->stmts) {
+                collect_writes(stmt, writes);
+            }
+        }
+        else if(type == nt::stmt_while) {
+            collect_writes(cur->body, writes);
+        }
+        else if(type == nt::stmt_decl) {
+            writes[cur->slot] |= declared;
+        }
+        else if(type == nt::stmt_assn) {
+            writes[cur->slot] |= assigned;
+        }
+    }
+};
+
+Chunk BytecodeGen::gen() {
+    if(tree_depth(ast) > max_bytecode_depth) {
+        bytecode_error(std::format("Programs nested more than {} deep cannot be compiled to bytecode", max_bytecode_depth));
+    }
+    InitAnalysis init(ast->frame_size);
+    init.stmt(ast);
+    checked_reads = std::move(init.checked_reads);
+    next_reg = ast->frame_size;
+    flags.assign(ast->frame_size, -1);
+    for(int32_t slot = 0; slot < ast->frame_size; ++slot) {
+        if(init.tracked[slot]) {
+            flags[slot] = next_reg++;
+        }
+    }
+    chunk.num_regs = next_reg;
+    chunk.num_vars = next_reg;
+    gen_stmt(ast);
+    emit(Op::halt);
+    return chunk;
+}
+
+void BytecodeGen::gen_stmt(Node* cur) {
+    nt type = cur->type;
+    int32_t temps_start = next_reg;
+    if(type == nt::prgm) {
+        for(Node* stmt : cur->stmts) {
+            gen_stmt(stmt);
+        }
+    }
+    else if(type == nt::block) {
+        for(Node* stmt : cur->stmts) {
+            gen_stmt(stmt);
+        }
+    }
+    else if(type == nt::stmt_while) {
+        // Condition at the bottom so each iteration only takes one jump
+        size_t enter = emit(Op::jmp);
+        size_t top = chunk.code.size();
+        gen_stmt(cur->body);
+        chunk.code[enter].a = chunk.code.size();
+        int32_t cond = gen_expr(cur->expr);
+        emit(Op::jnz, cond, top);
+        release_temps(temps_start);
+    }
+    else if(type == nt::stmt_decl) {
+        set_flag(cur->slot, 0);
+    }
+    else if(type == nt::stmt_assn) {
+        gen_expr_into(cur->expr, cur->slot);
+        set_flag(cur->slot, 1);
+        release_temps(temps_start);
+    }
+    else if(type == nt::stmt_return) {
+        emit(Op::print, gen_expr(cur->expr));
+        release_temps(temps_start);
+    }
+}
+
+void BytecodeGen::release_temps(int32_t temps_start) {
+    if(reuse_temps) {
+        next_reg = temps_start;
+    }
+}
+
+void BytecodeGen::set_flag(int32_t slot, int64_t value) {
+    if(flags[slot] >= 0) {
+        chunk.consts.push_back(value);
+        emit(Op::load_const, flags[slot], chunk.consts.size() - 1);
+    }
+}
+
+void BytecodeGen::check_read(Node* id) {
+    if(checked_reads.contains(id)) {
+        emit(Op::check, flags[id->slot], id->sym);
+    }
+}
+
+int32_t BytecodeGen::gen_expr(Node* cur) {
+    nt type = cur->type;
+    if(type == nt::lit_id) {
+        check_read(cur);
+        return cur->slot;
+    }
+    if(type == nt::paren_group || type == nt::unary_plus) {
+        return gen_expr(cur->expr);
+    }
+    int32_t dst = alloc_reg();
+    gen_expr_into(cur, dst);
+    return dst;
+}
+
+void BytecodeGen::gen_expr_into(Node* cur, int32_t dst) {
+    nt type = cur->type;
+    if(type == nt::lit_int) {
+        chunk.consts.push_back(cur->ival);
+        emit(Op::load_const, dst, chunk.consts.size() - 1);
+    }
+    else if(type == nt::lit_id) {
+        check_read(cur);
+        if(cur->slot != dst) {
+            emit(Op::mov, dst, cur->slot);
+        }
+    }
+    else if(type == nt::paren_group || type == nt::unary_plus) {
+        gen_expr_into(cur->expr, dst);
+    }
+    else if(type == nt::unary_minus) {
+        emit(Op::neg, dst, gen_expr(cur->expr));
+    }
+    else {
+        int32_t left = gen_expr(cur->left);
+        int32_t right = gen_expr(cur->right);
+        emit(biop_op(type), dst, left, right);
+    }
+}
+
+Op BytecodeGen::biop_op(nt type) {
+    switch(type) {
+        case nt::biop_plus:
+            return Op::add;
+        case nt::biop_minus:
+            return Op::sub;
+        case nt::biop_mul:
+            return Op::mul;
+        case nt::biop_div:
+            return Op::div;
+    }
+    bytecode_error(std::format("Cannot lower node type {} to bytecode", to_string::node_type(type)));
+    return Op::halt;
+}
+
+int32_t BytecodeGen::alloc_reg() {
+    int32_t reg = next_reg++;
+    if(next_reg > chunk.num_regs) {
+        chunk.num_regs = next_reg;
+    }
+    return reg;
+}
+
+size_t BytecodeGen::emit(Op op, int32_t a, int32_t b, int32_t c) {
+    chunk.code.push_back({ .op = op, .a = a, .b = b, .c = c });
+    return chunk.code.size() - 1;
+}
+
+void VM::run() {
+    const Instr* code = chunk.code.data();
+    const i64* consts = chunk.consts.data();
+    i64* r = regs.data();
+    const Instr* ip = code;
+    while(true) {
+        const Instr& in = *ip++;
+        switch(in.op) {
+            case Op::load_const:
+                r[in.a] = consts[in.b];
+                break;
+            case Op::mov:
+                r[in.a] = r[in.b];
+                break;
+            case Op::add:
+                r[in.a] = r[in.b] + r[in.c];
+                break;
+            case Op::sub:
+                r[in.a] = r[in.b] - r[in.c];
+                break;
+            case Op::mul:
+                r[in.a] = r[in.b] * r[in.c];
+                break;
+            case Op::div:
+                r[in.a] = r[in.b] / r[in.c];
+                break;
+            case Op::neg:
+                r[in.a] = -r[in.b];
+                break;
+            case Op::jmp:
+                ip = code + in.a;
+                break;
+            case Op::jnz:
+                if(r[in.a] != 0) {
+                    ip = code + in.b;
+                }
+                break;
+            case Op::print:
+                cout << r[in.a] << endl;
+                break;
+            case Op::check:
+                if(r[in.a] == 0) {
+                    uninitialized_error(in.b);
+                }
+                break;
+            case Op::halt:
+                return;
+        }
+    }
+}
+
+void VM::uninitialized_error(SymId sym) {
+    cout << std::format("symbol '{}' has not been initialized", names.name(sym)) << endl;
+    exit(9);
+}
+
+namespace to_string {
+    string op(Op op) {
+        switch(op) {
+            case Op::load_const:
+                return "load_const";
+            case Op::mov:
+                return "mov";
+            case Op::add:
+                return "add";
+            case Op::sub:
+                return "sub";
+            case Op::mul:
+                return "mul";
+            case Op::div:
+                return "div";
+            case Op::neg:
+                return "neg";
+            case Op::jmp:
+                return "jmp";
+            case Op::jnz:
+                return "jnz";
+            case Op::print:
+                return "print";
+            case Op::check:
+                return "check";
+            case Op::halt:
+                return "halt";
+        }
+        return "UNRECOG OP";
+    }
+
+    string chunk(const Chunk& chunk) {
+        string s;
+        for(size_t i = 0; i < chunk.code.size(); ++i) {
+            const Instr& in = chunk.code[i];
+            s += std::to_string(i) + ": " + to_string::op(in.op);
+            switch(in.op) {
+                case Op::load_const:
+                    s += std::format(" r{}, {}", in.a, chunk.consts[in.b]);
+                    break;
+                case Op::mov:
+                case Op::neg:
+                    s += std::format(" r{}, r{}", in.a, in.b);
+                    break;
+                case Op::add:
+                case Op::sub:
+                case Op::mul:
+                case Op::div:
+                    s += std::format(" r{}, r{}, r{}", in.a, in.b, in.c);
+                    break;
+                case Op::jmp:
+                    s += std::format(" {}", in.a);
+                    break;
+                case Op::jnz:
+                    s += std::format(" r{}, {}", in.a, in.b);
+                    break;
+                case Op::print:
+                    s += std::format(" r{}", in.a);
+                    break;
+                case Op::check:
+                    s += std::format(" r{}, sym {}", in.a, in.b);
+                    break;
+            }
+            s += "\n";
+        }
+        return s;
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "gavcc.h"
+#include <unordered_set>
+
+// Register based bytecode. Every instruction is the same width: an opcode
+// and three operands, which are register numbers, jump targets or indexes
+// into the constant pool depending on the opcode.
+enum class Op : uint8_t {
+    load_const, // r[a] = consts[b]
+    mov,        // r[a] = r[b]
+    add,        // r[a] = r[b] + r[c]
+    sub,        // r[a] = r[b] - r[c]
+    mul,        // r[a] = r[b] * r[c]
+    div,        // r[a] = r[b] / r[c]
+    neg,        // r[a] = -r[b]
+    jmp,        // pc = a
+    jnz,        // if(r[a] != 0) pc = b
+    print,      // print r[a]
+    check,      // stop with an error if r[a] is 0, b is the SymId
+    halt,
+};
+
+struct Instr {
+    Op op;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+};
+
+struct Chunk {
+    vector<Instr> code;
+    vector<int64_t> consts;
+    int32_t num_regs = 0;
+    // Registers below num_vars hold variables, then the initialized flags
+    // of the variables that need one. The rest are temporaries.
+    int32_t num_vars = 0;
+};
+
+namespace to_string {
+    string op(Op op);
+    string chunk(const Chunk& chunk);
+}
+
+constexpr size_t max_bytecode_depth = 10000;
+
+// Lowers a checked AST to a Chunk. Variables live in the registers matching
+// their SemAnal frame slots, temporaries are allocated above the frame and
+// are released at the end of every statement. With reuse_temps off every
+// temporary gets a register of its own, which is what LinearScan wants.
+//
+// Reads that may see an uninitialized variable are preceded by an
+// Op::check of the variable's flag register, which its declarations clear
+// and its assignments set. Variables whose reads are all known to be
+// initialized have no flag.
+//
+// Lowering recurses over the tree, so programs nested deeper than
+// max_bytecode_depth fail to compile, for --emit-asm too.
+class BytecodeGen {
+    Node* ast;
+    Chunk chunk;
+    int32_t next_reg = 0;
+    bool reuse_temps;
+    // Flag register of each slot, or -1
+    vector<int32_t> flags;
+    std::unordered_set<Node*> checked_reads;
+
+public:
+    BytecodeGen(Node* ast, bool reuse_temps = true): ast(ast), reuse_temps(reuse_temps) {}
+
+    Chunk gen();
+
+private:
+    void gen_stmt(Node* cur);
+    void release_temps(int32_t temps_start);
+    void set_flag(int32_t slot, int64_t value);
+    void check_read(Node* id);
+
+    // Returns the register holding the value of cur
+    int32_t gen_expr(Node* cur);
+
+    // Evaluates cur directly into dst, avoiding a trailing mov
+    void gen_expr_into(Node* cur, int32_t dst);
+    Op biop_op(NodeType type);
+    int32_t alloc_reg();
+    size_t emit(Op op, int32_t a = 0, int32_t b = 0, int32_t c = 0);
+};
+
+class VM {
+    const Chunk& chunk;
+    const Interner& names;
+    vector<int64_t> regs;
+
+public:
+    VM(const Chunk& chunk, const Interner& names): chunk(chunk), names(names), regs(chunk.num_regs) {}
+
+    void run();
+
+private:
+    [[noreturn]]
+    void uninitialized_error(SymId sym);
+};
@@ -0,0 +1,107 @@
+#include "cache.h"
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+uint64_t CompileCache::key(std::string_view source, std::string_view flags) {
+    uint64_t hash = fnv1a(0xcbf29ce484222325, std::format("gavcc cache {}", cache_format_version));
+    hash = fnv1a(hash, flags);
+    hash = fnv1a(hash, { "\0", 1 });
+    return fnv1a(hash, source);
+}
+
+bool CompileCache::load(uint64_t key, size_t source_size, string& output, int& code) {
+    fs::path path = entry_path(key);
+    std::ifstream file(path, std::ios::binary);
+    size_t size;
+    // The source size guards against the odd hash collision
+    if(!file || !(file >> size >> code) || file.get() != '\n' || size != source_size) {
+        ++misses;
+        return false;
+    }
+    output.assign(std::istreambuf_iterator<char>(file), {});
+    std::error_code ignored;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ignored);
+    ++hits;
+    return true;
+}
+
+void CompileCache::store(uint64_t key, size_t source_size, const string& output, int code) {
+    fs::path temp = dir / std::format("tmp.{}.{}", getpid(), next_temp++);
+    {
+        std::ofstream file(temp, std::ios::binary);
+        file << source_size << " " << code << "\n" << output;
+        if(!file.flush()) {
+            std::error_code ignored;
+            fs::remove(temp, ignored);
+            return;
+        }
+    }
+    std::error_code error;
+    fs::rename(temp, entry_path(key), error);
+    if(error) {
+        fs::remove(temp, error);
+    }
+}
+
+void CompileCache::evict() {
+    struct Entry {
+        fs::path path;
+        fs::file_time_type used;
+        uint64_t size;
+    };
+    vector<Entry> entries;
+    uint64_t total = 0;
+    fs::file_time_type stale = fs::file_time_type::clock::now() - stale_temp_age;
+    std::error_code list_error;
+    for(const fs::directory_entry& file : fs::directory_iterator(dir, list_error)) {
+        std::error_code time_error;
+        fs::file_time_type used = file.last_write_time(time_error);
+        if(time_error) {
+            continue;
+        }
+        if(file.path().filename().string().starts_with("tmp.")) {
+            if(used < stale) {
+                std::error_code ignored;
+                fs::remove(file.path(), ignored);
+            }
+            continue;
+        }
+        if(file.path().extension() != ".gvc") {
+            continue;
+        }
+        std::error_code size_error;
+        uint64_t size = file.file_size(size_error);
+        if(!size_error) {
+            entries.push_back({ file.path(), used, size });
+            total += size;
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.used < b.used;
+    });
+    for(const Entry& entry : entries) {
+        if(total <= max_bytes) {
+            break;
+        }
+        std::error_code remove_error;
+        if(fs::remove(entry.path, remove_error)) {
+            total -= entry.size;
+            ++evictions;
+        }
+    }
+}
+
+fs::path CompileCache::entry_path(uint64_t key) {
+    return dir / std::format("{:016x}.gvc", key);
+}
+
+uint64_t CompileCache::fnv1a(uint64_t hash, std::string_view bytes) {
+    for(char c : bytes) {
+        hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+    }
+    return hash;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "gavcc.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+
+// On disk cache of compile results, one file per entry named by the hash
+// of the source text, the flags that affect the output and
+// cache_format_version. Entries are written to a temporary file and
+// renamed into place, so concurrent compiles and crashes never leave a
+// torn entry behind. Every hit bumps the entry's mtime, and evict()
+// removes the least recently used entries until the directory fits in
+// max_bytes, along with temporary files a crash left behind.
+//
+// Bump cache_format_version whenever the entry layout changes, or the
+// output for the same source and flags does: generated C, fold, error
+// messages or exit codes.
+constexpr uint32_t cache_format_version = 1;
+
+class CompileCache {
+    std::filesystem::path dir;
+    uint64_t max_bytes;
+    std::atomic<uint64_t> next_temp = 0;
+    // A temporary file is renamed within moments of being written, one
+    // this old was left by a compile that died
+    static constexpr std::chrono::hours stale_temp_age{ 1 };
+
+public:
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> evictions = 0;
+
+    CompileCache(const string& dir, uint64_t max_bytes): dir(dir), max_bytes(max_bytes) {
+        std::filesystem::create_directories(this->dir);
+    }
+
+    // flags is anything besides the source that changes the output
+    static uint64_t key(std::string_view source, std::string_view flags);
+    bool load(uint64_t key, size_t source_size, string& output, int& code);
+
+    // Failures are ignored, the cache is only ever an optimization
+    void store(uint64_t key, size_t source_size, const string& output, int code);
+    void evict();
+
+private:
+    std::filesystem::path entry_path(uint64_t key);
+
+    static uint64_t fnv1a(uint64_t hash, std::string_view bytes);
+};
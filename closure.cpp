@@ -0,0 +1,337 @@
+#include "closure.h"
+#include <format>
+#include <functional>
+#include <iostream>
+
+using i64 = int64_t;
+using std::cout;
+using std::endl;
+using nt = NodeType;
+
+// How each kind of operand is read. The closures are instantiated for the
+// kinds of their operands, so a literal is read in place and only a
+// subexpression costs a call.
+struct LitReader {
+    static i64 get(const Operand& operand, ClosureEval&) {
+        return operand.value;
+    }
+};
+
+struct SlotReader {
+    static i64 get(const Operand& operand, ClosureEval& eval) {
+        return eval.read(operand);
+    }
+};
+
+struct ExprReader {
+    static i64 get(const Operand& operand, ClosureEval& eval) {
+        return operand.expr->run(operand.expr, eval);
+    }
+};
+
+// Calls f with the reader for kind
+template <typename F>
+auto with_reader(OperandKind kind, F f) {
+    switch(kind) {
+        case OperandKind::lit:
+            return f(LitReader());
+        case OperandKind::slot:
+            return f(SlotReader());
+        default:
+            return f(ExprReader());
+    }
+}
+
+template <typename Op, typename Left, typename Right>
+i64 run_biop(const ClosureExpr* expr, ClosureEval& eval) {
+    // Left first, so the same uninitialized read is reported as by Eval
+    i64 left = Left::get(expr->left, eval);
+    return Op()(left, Right::get(expr->right, eval));
+}
+
+template <typename Value>
+i64 run_neg(const ClosureExpr* expr, ClosureEval& eval) {
+    return -Value::get(expr->left, eval);
+}
+
+// Calls f with the function object of a binary operator
+template <typename F>
+auto with_op(nt type, F f) {
+    switch(type) {
+        case nt::biop_plus:
+            return f(std::plus<i64>());
+        case nt::biop_minus:
+            return f(std::minus<i64>());
+        case nt::biop_mul:
+            return f(std::multiplies<i64>());
+        default:
+            return f(std::divides<i64>());
+    }
+}
+
+ClosureExprFn biop_fn(nt type, OperandKind left, OperandKind right) {
+    return with_op(type, [=](auto op) {
+        return with_reader(left, [=](auto left_reader) {
+            return with_reader(right, [](auto right_reader) -> ClosureExprFn {
+                return run_biop<decltype(op), decltype(left_reader), decltype(right_reader)>;
+            });
+        });
+    });
+}
+
+template <typename Op, typename Right>
+i64 run_step(i64 left, const Operand& right, ClosureEval& eval) {
+    return Op()(left, Right::get(right, eval));
+}
+
+ClosureStepFn step_fn(nt type, OperandKind right) {
+    return with_op(type, [=](auto op) {
+        return with_reader(right, [](auto reader) -> ClosureStepFn {
+            return run_step<decltype(op), decltype(reader)>;
+        });
+    });
+}
+
+template <typename First>
+i64 run_chain(const ClosureExpr* expr, ClosureEval& eval) {
+    const ClosureChain* chain = static_cast<const ClosureChain*>(expr);
+    i64 value = First::get(chain->left, eval);
+    for(const ChainStep& step : chain->steps) {
+        value = step.apply(value, step.operand, eval);
+    }
+    return value;
+}
+
+void run_stmts(std::span<const ClosureStmt*> stmts, ClosureEval& eval) {
+    for(const ClosureStmt* stmt : stmts) {
+        stmt->run(stmt, eval);
+    }
+}
+
+void run_block(const ClosureStmt* stmt, ClosureEval& eval) {
+    run_stmts(stmt->stmts, eval);
+}
+
+void run_decl(const ClosureStmt* stmt, ClosureEval& eval) {
+    eval.decl(stmt->slot);
+}
+
+template <typename Value>
+void run_assn(const ClosureStmt* stmt, ClosureEval& eval) {
+    eval.assn(stmt->slot, Value::get(stmt->operand, eval));
+}
+
+template <typename Value>
+void run_return(const ClosureStmt* stmt, ClosureEval& eval) {
+    i64 value = Value::get(stmt->operand, eval);
+    cout << value << endl;
+}
+
+template <typename Cond>
+void run_while(const ClosureStmt* stmt, ClosureEval& eval) {
+    while(Cond::get(stmt->operand, eval)) {
+        run_stmts(stmt->stmts, eval);
+    }
+}
+
+void closure_error(string msg) {
+    cout << msg << endl;
+    exit(17);
+}
+
+bool is_biop(Node* cur) {
+    return cur->type == nt::biop_plus || cur->type == nt::biop_minus
+        || cur->type == nt::biop_mul || cur->type == nt::biop_div;
+}
+
+Node* skip_parens(Node* cur) {
+    while(cur->type == nt::paren_group || cur->type == nt::unary_plus) {
+        cur = cur->expr;
+    }
+    return cur;
+}
+
+// A loop whose body is a single statement reads it as a block of one
+size_t body_size(Node* body) {
+    return body->type == nt::prgm || body->type == nt::block ? body->stmts.size() : 1;
+}
+
+Node* body_stmt(Node* body, size_t i) {
+    return body->type == nt::prgm || body->type == nt::block ? body->stmts[i] : body;
+}
+
+const ClosureStmt* ClosureGen::gen() {
+    ClosureStmt* program = arena.make<ClosureStmt>();
+    program->run = run_block;
+    open_bodies.push_back({ program, {}, { { ast, 0 } } });
+    while(!open_bodies.empty()) {
+        OpenBody& body = open_bodies.back();
+        if(body.blocks.empty()) {
+            body.stmt->stmts = arena.make_array(body.stmts);
+            open_bodies.pop_back();
+            continue;
+        }
+        auto& [block, next] = body.blocks.back();
+        if(next == body_size(block)) {
+            body.blocks.pop_back();
+            continue;
+        }
+        Node* cur = body_stmt(block, next++);
+        if(cur->type == nt::block) {
+            body.blocks.push_back({ cur, 0 });
+        }
+        else {
+            // May open a loop body, after which body is stale
+            gen_stmt(cur);
+        }
+    }
+    return program;
+}
+
+void ClosureGen::gen_stmt(Node* cur) {
+    nt type = cur->type;
+    ClosureStmt* stmt = arena.make<ClosureStmt>();
+    open_bodies.back().stmts.push_back(stmt);
+    if(type == nt::stmt_while) {
+        stmt->operand = gen_operand(cur->expr);
+        stmt->run = with_reader(stmt->operand.kind, [](auto cond) -> ClosureStmtFn {
+            return run_while<decltype(cond)>;
+        });
+        if(open_bodies.size() >= max_closure_depth) {
+            closure_error(std::format("Loops nested more than {} deep cannot be compiled to closures", max_closure_depth));
+        }
+        open_bodies.push_back({ stmt, {}, { { cur->body, 0 } } });
+    }
+    else if(type == nt::stmt_decl) {
+        stmt->slot = cur->slot;
+        stmt->run = run_decl;
+    }
+    else if(type == nt::stmt_assn) {
+        stmt->slot = cur->slot;
+        stmt->operand = gen_operand(cur->expr);
+        stmt->run = with_reader(stmt->operand.kind, [](auto value) -> ClosureStmtFn {
+            return run_assn<decltype(value)>;
+        });
+    }
+    else {
+        // stmt_return
+        stmt->operand = gen_operand(cur->expr);
+        stmt->run = with_reader(stmt->operand.kind, [](auto value) -> ClosureStmtFn {
+            return run_return<decltype(value)>;
+        });
+    }
+}
+
+Operand ClosureGen::gen_operand(Node* root) {
+    pending.push_back({ ExprTask::gen, root });
+    while(!pending.empty()) {
+        ExprTask task = pending.back();
+        pending.pop_back();
+        Node* cur = task.node;
+        if(task.kind == ExprTask::gen) {
+            // Parens and unary plus leave no trace, and minuses cancel in pairs
+            bool negate = false;
+            for(; cur->type == nt::paren_group || cur->type == nt::unary_plus || cur->type == nt::unary_minus; cur = cur->expr) {
+                negate ^= cur->type == nt::unary_minus;
+            }
+            if(negate) {
+                pending.push_back({ ExprTask::neg, cur });
+            }
+
+            Operand operand;
+            if(cur->type == nt::lit_int) {
+                operand.value = cur->ival;
+                operands.push_back({ operand, 0 });
+            }
+            else if(cur->type == nt::lit_id) {
+                operand.kind = OperandKind::slot;
+                operand.slot = cur->slot;
+                operand.id = cur;
+                operands.push_back({ operand, 0 });
+            }
+            else if(is_biop(skip_parens(cur->left))) {
+                // The leftmost operand runs first, then the right operands
+                // from the innermost operator out
+                pending.push_back({ ExprTask::chain, cur });
+                for(; is_biop(cur); cur = skip_parens(cur->left)) {
+                    pending.push_back({ ExprTask::gen, cur->right });
+                }
+                pending.push_back({ ExprTask::gen, cur });
+            }
+            else {
+                pending.push_back({ ExprTask::biop, cur });
+                pending.push_back({ ExprTask::gen, cur->right });
+                pending.push_back({ ExprTask::gen, cur->left });
+            }
+        }
+        else if(task.kind == ExprTask::neg) {
+            auto [value, depth] = operands.back();
+            operands.pop_back();
+            if(value.kind == OperandKind::lit) {
+                // A negative literal
+                value.value = -value.value;
+                operands.push_back({ value, 0 });
+                continue;
+            }
+            ClosureExpr* expr = arena.make<ClosureExpr>();
+            expr->left = value;
+            expr->run = with_reader(value.kind, [](auto reader) -> ClosureExprFn {
+                return run_neg<decltype(reader)>;
+            });
+            push_expr(expr, depth + 1);
+        }
+        else if(task.kind == ExprTask::biop) {
+            auto [right, right_depth] = operands.back();
+            operands.pop_back();
+            auto [left, left_depth] = operands.back();
+            operands.pop_back();
+            ClosureExpr* expr = arena.make<ClosureExpr>();
+            expr->left = left;
+            expr->right = right;
+            expr->run = biop_fn(cur->type, left.kind, right.kind);
+            push_expr(expr, std::max(left_depth, right_depth) + 1);
+        }
+        else {
+            // chain, its operators from the outermost in
+            chain_ops.clear();
+            for(; is_biop(cur); cur = skip_parens(cur->left)) {
+                chain_ops.push_back(cur->type);
+            }
+            size_t first = operands.size() - chain_ops.size() - 1;
+            size_t depth = operands[first].second;
+            vector<ChainStep> steps;
+            for(size_t i = 0; i < chain_ops.size(); i++) {
+                auto& [operand, operand_depth] = operands[first + 1 + i];
+                steps.push_back({ step_fn(chain_ops[chain_ops.size() - 1 - i], operand.kind), operand });
+                depth = std::max(depth, operand_depth);
+            }
+            ClosureChain* chain = arena.make<ClosureChain>();
+            chain->left = operands[first].first;
+            chain->steps = arena.make_array(steps);
+            chain->run = with_reader(chain->left.kind, [](auto reader) -> ClosureExprFn {
+                return run_chain<decltype(reader)>;
+            });
+            operands.resize(first);
+            push_expr(chain, depth + 1);
+        }
+    }
+    Operand operand = operands.back().first;
+    operands.pop_back();
+    return operand;
+}
+
+// Closures nest inside the loops around them when running
+void ClosureGen::push_expr(ClosureExpr* expr, size_t depth) {
+    if(open_bodies.size() + depth > max_closure_depth) {
+        closure_error(std::format("Expressions nested more than {} deep cannot be compiled to closures", max_closure_depth));
+    }
+    Operand operand;
+    operand.kind = OperandKind::expr;
+    operand.expr = expr;
+    operands.push_back({ operand, depth });
+}
+
+void ClosureEval::uninitialized_error(Node* id) {
+    cout << format("symbol '{}' has not been initialized", names.name(id->sym)) << endl;
+    exit(9);
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include "gavcc.h"
+#include "eval.h"
+
+// Closure compilation: the checked AST is compiled once into a tree of
+// closures, each a function pointer specialized for its node type and for
+// what its operands are, with their slots and literals filled in. Running
+// the program is calling through them, without looking at a NodeType.
+// Compiling walks the AST with explicit stacks. Running recurses through
+// nested closures, so nesting is flattened where the closures allow it:
+// blocks are run as part of the enclosing statement list, a left-leaning
+// chain of operators is one closure looping over its operands and a run of
+// unary minuses is at most one negation. What still nests, loops and
+// operands on the right, fails to compile past max_closure_depth.
+struct ClosureExpr;
+struct ClosureStmt;
+class ClosureEval;
+
+using ClosureExprFn = int64_t (*)(const ClosureExpr* expr, ClosureEval& eval);
+using ClosureStmtFn = void (*)(const ClosureStmt* stmt, ClosureEval& eval);
+
+enum class OperandKind : uint8_t {
+    lit,
+    slot,
+    expr,
+};
+
+// A value resolved when compiling: a literal, a variable's slot, or the
+// closure of a subexpression. Parens and unary plus leave no trace.
+struct Operand {
+    OperandKind kind = OperandKind::lit;
+    int64_t value = 0;
+    int32_t slot = -1;
+    // The lit_id, for the uninitialized error
+    Node* id = nullptr;
+    const ClosureExpr* expr = nullptr;
+};
+
+// A binary operator, or unary minus on left
+struct ClosureExpr {
+    ClosureExprFn run;
+    Operand left;
+    Operand right;
+};
+
+// One operator of a chain, applied to the value so far and its operand
+using ClosureStepFn = int64_t (*)(int64_t left, const Operand& right, ClosureEval& eval);
+
+struct ChainStep {
+    ClosureStepFn apply;
+    Operand operand;
+};
+
+// A left-leaning chain of binary operators, like a - b + c * d: left is
+// the leftmost operand, and each step applies the next operator
+struct ClosureChain: ClosureExpr {
+    std::span<const ChainStep> steps;
+};
+
+// Closures nested deeper than this make compiling fail instead of running
+// out of stack
+constexpr size_t max_closure_depth = 10000;
+
+struct ClosureStmt {
+    ClosureStmtFn run;
+    // Slot declared or assigned
+    int32_t slot = -1;
+    // Value assigned or returned, or a loop's condition
+    Operand operand;
+    // Statements of a block, or of a loop's body
+    std::span<const ClosureStmt*> stmts;
+};
+
+// Compiles a checked AST. The closures live in its arena.
+class ClosureGen {
+    Node* ast;
+    Arena arena;
+
+public:
+    ClosureGen(Node* ast): ast(ast) {}
+
+    // The closure of the whole program, valid as long as this ClosureGen
+    const ClosureStmt* gen();
+
+private:
+    // A block or loop body whose statements are being compiled
+    struct OpenBody {
+        ClosureStmt* stmt;
+        vector<const ClosureStmt*> stmts;
+        // The block and nested blocks flattened into stmts, innermost
+        // last, with the index of the next statement of each
+        vector<std::pair<Node*, size_t>> blocks;
+    };
+    // Innermost last, so loops nest through these and not the call stack
+    vector<OpenBody> open_bodies;
+
+    // Work list of gen_operand: nodes to compile, and nodes to finish once
+    // their operands are compiled
+    struct ExprTask {
+        enum Kind : uint8_t { gen, neg, biop, chain } kind;
+        Node* node;
+    };
+    vector<ExprTask> pending;
+    // Compiled operands, with how deep their closures nest
+    vector<std::pair<Operand, size_t>> operands;
+    vector<NodeType> chain_ops;
+
+    void gen_stmt(Node* cur);
+    Operand gen_operand(Node* root);
+    void push_expr(ClosureExpr* expr, size_t depth);
+};
+
+class ClosureEval {
+    const ClosureStmt* program;
+    const Interner& names;
+    Frame frame;
+
+public:
+    ClosureEval(const ClosureStmt* program, int32_t frame_size, const Interner& names):
+        program(program), names(names), frame(frame_size) {}
+
+    int64_t eval() {
+        program->run(program, *this);
+        return 0;
+    }
+
+    // Value of a slot operand
+    int64_t read(const Operand& operand) {
+        if(!frame.is_initialized(operand.slot)) {
+            uninitialized_error(operand.id);
+        }
+        return frame.get(operand.slot);
+    }
+
+    void decl(int32_t slot) {
+        frame.decl(slot);
+    }
+
+    void assn(int32_t slot, int64_t value) {
+        frame.assn(slot, value);
+    }
+
+    [[noreturn]]
+    void uninitialized_error(Node* id);
+};
@@ -1,127 +1,158 @@
-#include "gavcc.h"
-#include <format>
+#include "codegen.h"
+#include <algorithm>
 
-using tt = TokenType;
 using nt = NodeType;
 
-class CodeGen {
-    Node* ast;
-    string out;
-    string indent;
-    bool starting_new_line = true;
-public:
-    CodeGen(Node* ast): ast(ast) {}
-
-    string code_gen() {
-        code_gen_node(ast);
-        return out;
-    }
-private:
-    void code_gen_node(Node* cur) {
-        nt type = cur->type;
-        if(type == nt::prgm) {
-            for(Node* stmt : cur->stmts) {
-                code_gen_node(stmt);
-            }
-        }
-        else if(type == nt::block) {
-            writeln("{");
-            inc_indent();
-            for(Node* stmt : cur->stmts) {
-                code_gen_node(stmt);
-            }
-            dec_indent();
-            writeln("}");
-        }
-        else if(type == nt::stmt_while) {
-            write("while(");
-            code_gen_node(cur->expr);
-            write(")");
-            if(cur->body->type == nt::block) {
-                write(" ");
-                code_gen_node(cur->body);
-            }
-            else {
-                writeln("");
+void CodeGen::code_gen() {
+    code_gen_node(ast);
+}
+
+void CodeGen::code_gen_node(Node* root) {
+    pending.push_back({ Task::gen_node, root });
+    while(!pending.empty()) {
+        Task task = pending.back();
+        pending.pop_back();
+        switch(task.kind) {
+            case Task::gen_node:
+                visit(task.node);
+                break;
+            case Task::gen_stmts:
+                if(task.next < task.node->stmts.size()) {
+                    pending.push_back({ Task::gen_stmts, task.node, nullptr, task.next + 1 });
+                    pending.push_back({ Task::gen_node, task.node->stmts[task.next] });
+                }
+                break;
+            case Task::write_text:
+                write(task.text);
+                break;
+            case Task::writeln_text:
+                writeln(task.text);
+                break;
+            case Task::inc:
                 inc_indent();
-                code_gen_node(cur->body);
+                break;
+            case Task::dec:
                 dec_indent();
-            }
-        }
-        else if(type == nt::stmt_decl) {
-            writeln(format("int {};", cur->id));
-        }
-        else if(type == nt::stmt_assn) {
-            write(format("{} = ", cur->id));
-            code_gen_node(cur->expr);
-            writeln(";");
-        }
-        else if(type == nt::stmt_return) {
-            write("return ");
-            code_gen_node(cur->expr);
-            writeln(";");
-        }
-        else if(type == nt::paren_group) {
-            write("(");
-            code_gen_node(cur->expr);
-            write(")");
-        }
-        else if(type == nt::biop_plus) {
-            code_gen_node(cur->left);
-            write(" + ");
-            code_gen_node(cur->right);
-        }
-        else if(type == nt::biop_minus) {
-            code_gen_node(cur->left);
-            write(" - ");
-            code_gen_node(cur->right);
-        }
-        else if(type == nt::biop_mul) {
-            code_gen_node(cur->left);
-            write(" * ");
-            code_gen_node(cur->right);
-        }
-        else if(type == nt::biop_div) {
-            code_gen_node(cur->left);
-            write(" / ");
-            code_gen_node(cur->right);
-        }
-        else if(type == nt::unary_plus) {
-            write("+");
-            code_gen_node(cur->expr);
-        }
-        else if(type == nt::unary_minus) {
-            write("-");
-            code_gen_node(cur->expr);
-        }
-        else if(type == nt::lit_int) {
-            string ival = std::to_string(cur->ival);
-            write(format("{}", ival));
-        }
-        else if(type == nt::lit_id) {
-            write(format("{}", cur->id));
+                break;
         }
     }
+}
 
-    void writeln(string s) {
-        write(s + '\n');
-        starting_new_line = true;
-    }
+void CodeGen::visit_prgm(Node* cur) {
+    pending.push_back({ Task::gen_stmts, cur });
+}
 
-    void write(string s) {
-        if(starting_new_line) {
-            out += indent;
-            starting_new_line = false;
-        }
-        out += s;
-    }
+void CodeGen::visit_block(Node* cur) {
+    writeln("{");
+    inc_indent();
+    pending.push_back({ Task::writeln_text, nullptr, "}" });
+    pending.push_back({ Task::dec });
+    pending.push_back({ Task::gen_stmts, cur });
+}
 
-    void inc_indent() {
-        indent += "    ";
+void CodeGen::visit_stmt_while(Node* cur) {
+    write("while(");
+    if(cur->body->type == nt::block) {
+        pending.push_back({ Task::gen_node, cur->body });
+        pending.push_back({ Task::write_text, nullptr, ") " });
     }
-
-    void dec_indent() {
-        indent = indent.substr(0, indent.size() - 4);
+    else {
+        pending.push_back({ Task::dec });
+        pending.push_back({ Task::gen_node, cur->body });
+        pending.push_back({ Task::inc });
+        pending.push_back({ Task::writeln_text, nullptr, ")" });
     }
+    pending.push_back({ Task::gen_node, cur->expr });
+}
+
+void CodeGen::visit_stmt_decl(Node* cur) {
+    write("int ");
+    write(names.name(cur->sym));
+    writeln(";");
+}
+
+void CodeGen::visit_stmt_assn(Node* cur) {
+    write(names.name(cur->sym));
+    write(" = ");
+    pending.push_back({ Task::writeln_text, nullptr, ";" });
+    pending.push_back({ Task::gen_node, cur->expr });
+}
+
+void CodeGen::visit_stmt_return(Node* cur) {
+    write("return ");
+    pending.push_back({ Task::writeln_text, nullptr, ";" });
+    pending.push_back({ Task::gen_node, cur->expr });
+}
+
+void CodeGen::visit_paren_group(Node* cur) {
+    write("(");
+    pending.push_back({ Task::write_text, nullptr, ")" });
+    pending.push_back({ Task::gen_node, cur->expr });
+}
+
+void CodeGen::visit_biop_plus(Node* cur) {
+    binary(cur, " + ");
+}
+
+void CodeGen::visit_biop_minus(Node* cur) {
+    binary(cur, " - ");
+}
+
+void CodeGen::visit_biop_mul(Node* cur) {
+    binary(cur, " * ");
+}
+
+void CodeGen::visit_biop_div(Node* cur) {
+    binary(cur, " / ");
+}
 
-};
+void CodeGen::binary(Node* cur, const char* op) {
+    pending.push_back({ Task::gen_node, cur->right });
+    pending.push_back({ Task::write_text, nullptr, op });
+    pending.push_back({ Task::gen_node, cur->left });
+}
+
+void CodeGen::visit_unary_plus(Node* cur) {
+    write("+");
+    pending.push_back({ Task::gen_node, cur->expr });
+}
+
+void CodeGen::visit_unary_minus(Node* cur) {
+    write("-");
+    pending.push_back({ Task::gen_node, cur->expr });
+}
+
+void CodeGen::visit_lit_int(Node* cur) {
+    indent_if_new_line();
+    out.write_int(cur->ival);
+}
+
+void CodeGen::visit_lit_id(Node* cur) {
+    write(names.name(cur->sym));
+}
+
+void CodeGen::writeln(std::string_view s) {
+    write(s);
+    out.put('\n');
+    starting_new_line = true;
+}
+
+void CodeGen::write(std::string_view s) {
+    indent_if_new_line();
+    out.write(s);
+}
+
+// Copies from a run of spaces instead of keeping an indent string
+void CodeGen::indent_if_new_line() {
+    if(!starting_new_line) {
+        return;
+    }
+    starting_new_line = false;
+    static const string spaces(1024, ' ');
+    size_t left = indent * 4;
+    while(left > 0) {
+        size_t n = std::min(left, spaces.size());
+        out.write(std::string_view(spaces).substr(0, n));
+        left -= n;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "gavcc.h"
+#include "output.h"
+#include "visitor.h"
+
+// Visit functions write what comes before a node's first child, and queue
+// the children with the text between and after them, last first
+class CodeGen : public NodeVisitor<CodeGen> {
+    friend class NodeVisitor<CodeGen>;
+    Node* ast;
+    const Interner& names;
+    OutputSink& out;
+    // Levels of four spaces
+    size_t indent = 0;
+    bool starting_new_line = true;
+    // What is left to do, last first: nodes to generate, and the text and
+    // indent changes that come after them
+    struct Task {
+        enum Kind { gen_node, gen_stmts, write_text, writeln_text, inc, dec } kind;
+        Node* node;
+        const char* text;
+        // Next statement for gen_stmts, so a block is queued one statement
+        // at a time and memory grows with nesting rather than length
+        size_t next;
+    };
+    vector<Task> pending;
+public:
+    CodeGen(Node* ast, const Interner& names, OutputSink& out): ast(ast), names(names), out(out) {}
+
+    // Writes the C to out, which it leaves unflushed
+    void code_gen();
+private:
+    void code_gen_node(Node* root);
+
+    void visit_prgm(Node* cur);
+    void visit_block(Node* cur);
+    void visit_stmt_while(Node* cur);
+    void visit_stmt_decl(Node* cur);
+    void visit_stmt_assn(Node* cur);
+    void visit_stmt_return(Node* cur);
+    void visit_paren_group(Node* cur);
+    void visit_biop_plus(Node* cur);
+    void visit_biop_minus(Node* cur);
+    void visit_biop_mul(Node* cur);
+    void visit_biop_div(Node* cur);
+    void visit_unary_plus(Node* cur);
+    void visit_unary_minus(Node* cur);
+    void visit_lit_int(Node* cur);
+    void visit_lit_id(Node* cur);
+    void binary(Node* cur, const char* op);
+
+    void writeln(std::string_view s);
+    void write(std::string_view s);
+    void indent_if_new_line();
+
+    void inc_indent() {
+        ++indent;
+    }
+
+    void dec_indent() {
+        --indent;
+    }
+
+};
@@ -1,162 +1,188 @@
-#include "gavcc.h"
+#include "eval.h"
 #include <iostream>
-#include <optional>
-#include <unordered_map>
 #include <format>
 
 using i64 = int64_t;
 using std::cout;
 using std::endl;
-using std::unordered_map;
-using std::optional;
-using std::nullopt;
-using tt = TokenType;
 using nt = NodeType;
 
-class ScopedSymbolTable {
-    vector<unordered_map<string, optional<int>>> scopes;
-public:
-    ScopedSymbolTable() {
-        scopes.push_back({});
+void Eval::exec(Node* root) {
+    visit(root);
+    while(!open_stmts.empty()) {
+        OpenStmt& top = open_stmts.back();
+        Node* cur = top.node;
+        if(cur->type == nt::stmt_while) {
+            if(top.next && jit && top.iterations != jit_failed && jit->is_hot(++top.iterations)) {
+                if(JitLoop loop = jit->get(cur)) {
+                    open_stmts.pop_back();
+                    run_jit_loop(loop);
+                    continue;
+                }
+                top.iterations = jit_failed;
+            }
+            if(!eval_expr(cur->expr)) {
+                open_stmts.pop_back();
+                continue;
+            }
+            top.next = 1;
+            visit(cur->body);
+        }
+        else if(top.next < cur->stmts.size()) {
+            visit(cur->stmts[top.next++]);
+        }
+        else {
+            open_stmts.pop_back();
+        }
     }
-    void add_symbol(string sym);
-    void assn_value(string sym, int value);
-    int get_value(string sym);
-    void add_scope();
-    void close_scope();
-};
+}
 
-class Eval {
-    Node* ast;
-    ScopedSymbolTable scopes;
+void Eval::visit_prgm(Node* cur) {
+    open_stmts.push_back({ cur, 0, 0 });
+}
+
+void Eval::visit_block(Node* cur) {
+    open_stmts.push_back({ cur, 0, 0 });
+}
+
+void Eval::visit_stmt_while(Node* cur) {
+    open_stmts.push_back({ cur, 0, 0 });
+}
+
+void Eval::visit_stmt_decl(Node* cur) {
+    frame.decl(cur->slot);
+}
+
+void Eval::visit_stmt_assn(Node* cur) {
+    i64 value = eval_expr(cur->expr);
+    frame.assn(cur->slot, value);
+}
+
+void Eval::visit_stmt_return(Node* cur) {
+    i64 value = eval_expr(cur->expr);
+    cout << value << endl;
+}
+
+// Each visit returns the child to go down to, or nullptr at a leaf, whose
+// value it leaves in leaf. A visitor of its own rather than part of Eval's,
+// so the dispatch isn't reentered through the statements and inlines into
+// eval_expr.
+class Eval::Descent : public NodeVisitor<Descent, Node*> {
+    friend class NodeVisitor<Descent, Node*>;
+    Eval& eval;
 
 public:
-    Eval(Node* ast): ast(ast) {}
+    i64 leaf = 0;
 
-    int64_t eval() {
-        return eval_node(ast);
-    }
+    Descent(Eval& eval): eval(eval) {}
 
 private:
-    i64 eval_node(Node* cur) {
-        nt type = cur->type;
-        if(type == nt::prgm) {
-            for(Node* stmt : cur->stmts) {
-                eval_node(stmt);
-            }
-        }
-        else if(type == nt::block) {
-            scopes.add_scope();
-            for(Node* stmt : cur->stmts) {
-                eval_node(stmt);
-            }
-            scopes.close_scope();
-        }
-        else if(type == nt::stmt_while) {
-            while(eval_node(cur->expr)) {
-                eval_node(cur->body);
-            }
-        }
-        else if(type == nt::stmt_decl) {
-            string id = cur->id;
-            scopes.add_symbol(id);
-        }
-        else if(type == nt::stmt_assn) {
-            string id = cur->id;
-            i64 value = eval_node(cur->expr);
-            scopes.assn_value(id, value);
-        }
-        else if(type == nt::stmt_return) {
-            i64 value = eval_node(cur->expr);
-            cout << value << endl;
-        }
-        else if(type == nt::paren_group) {
-            return eval_node(cur->expr);
+    Node* visit_paren_group(Node* cur) {
+        eval.open_exprs.push_back({ cur, 0, false });
+        return cur->expr;
+    }
+
+    Node* visit_unary(Node* cur) {
+        eval.open_exprs.push_back({ cur, 0, false });
+        return cur->expr;
+    }
+
+    Node* visit_binary(Node* cur) {
+        eval.open_exprs.push_back({ cur, 0, false });
+        return cur->left;
+    }
+
+    Node* visit_lit_int(Node* cur) {
+        leaf = cur->ival;
+        return nullptr;
+    }
+
+    Node* visit_lit_id(Node* cur) {
+        if(!eval.frame.is_initialized(cur->slot)) {
+            eval.uninitialized_error(cur);
         }
-        else if(type == nt::biop_plus) {
-            i64 left = eval_node(cur->left);
-            i64 right = eval_node(cur->right);
+        leaf = eval.frame.get(cur->slot);
+        return nullptr;
+    }
+
+    // Statements never sit inside an expression
+    Node* visit_other(Node*) {
+        return nullptr;
+    }
+};
+
+i64 apply_biop(nt type, i64 left, i64 right) {
+    switch(type) {
+        case nt::biop_plus:
             return left + right;
-        }
-        else if(type == nt::biop_minus) {
-            i64 left = eval_node(cur->left);
-            i64 right = eval_node(cur->right);
+        case nt::biop_minus:
             return left - right;
-        }
-        else if(type == nt::biop_mul) {
-            i64 left = eval_node(cur->left);
-            i64 right = eval_node(cur->right);
+        case nt::biop_mul:
             return left * right;
-        }
-        else if(type == nt::biop_div) {
-            i64 left = eval_node(cur->left);
-            i64 right = eval_node(cur->right);
+        default:
             return left / right;
-        }
-        else if(type == nt::unary_plus) {
-            return eval_node(cur->expr);
-        }
-        else if(type == nt::unary_minus) {
-            return -eval_node(cur->expr);
-        }
-        else if(type == nt::lit_int) {
-            return cur->token.ival;
-        }
-        else if(type == nt::lit_id) {
-            string name = cur->id;
-            int value = scopes.get_value(name);
-            return value;
-        }
-        else {
-            cout << format("UNRECOGNIZED NODE TYPE: {}", to_string::node_type(type)) << endl;
-        }
-        return 0;
     }
-};
-
-void ScopedSymbolTable::add_symbol(string sym) {
-    auto& cur_scope = scopes.back();
-    if(cur_scope.contains(sym)) {
-        cout << format("symbol '{}' has already been defined", sym) << endl;
-        exit(10);
-    }
-    cur_scope.insert({sym, nullopt});
 }
 
-void ScopedSymbolTable::assn_value(string sym, int value) {
-    for(auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-        if(it->contains(sym)) {
-            it->at(sym) = optional(value);
-            return;
-        }
-    }
-    cout << format("symbol '{}' not found", sym) << endl;
-    exit(12);
-}
+// Goes down the left spine to a leaf, then back up through open_exprs
+// until an operator still needs its right operand. Leaves on the right are
+// read in place, which covers most operands without touching the stack.
+i64 Eval::eval_expr(Node* root) {
+    size_t bottom = open_exprs.size();
+    Descent descent(*this);
+    Node* cur = root;
+    while(true) {
+        while(cur) {
+            cur = descent.visit(cur);
+        }
+        i64 value = descent.leaf;
 
-int ScopedSymbolTable::get_value(string sym) {
-    for(auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-        if(it->contains(sym)) {
-            optional<int> value = it->at(sym);
-            if(!value.has_value()) {
-                cout << format("symbol '{}' has not been initialized", sym) << endl;
-                exit(9);
+        while(true) {
+            if(open_exprs.size() == bottom) {
+                return value;
+            }
+            OpenExpr& top = open_exprs.back();
+            Node* op = top.node;
+            if(op->type == nt::unary_minus) {
+                value = -value;
+            }
+            else if(op->type == nt::paren_group || op->type == nt::unary_plus) {
+                // value passes through
             }
-            return value.value();
+            else if(top.has_left) {
+                value = apply_biop(op->type, top.left, value);
+            }
+            else {
+                Node* right = op->right;
+                if(right->type == nt::lit_int) {
+                    value = apply_biop(op->type, value, right->ival);
+                }
+                else if(right->type == nt::lit_id) {
+                    if(!frame.is_initialized(right->slot)) {
+                        uninitialized_error(right);
+                    }
+                    value = apply_biop(op->type, value, frame.get(right->slot));
+                }
+                else {
+                    top.left = value;
+                    top.has_left = true;
+                    cur = right;
+                    break;
+                }
+            }
+            open_exprs.pop_back();
         }
     }
-    cout << format("symbol '{}' not found", sym) << endl;
-    exit(8);
 }
 
-void ScopedSymbolTable::add_scope() {
-    scopes.push_back({});
+void Eval::run_jit_loop(JitLoop loop) {
+    Node* failed = loop(frame.values_data(), frame.initialized_data());
+    if(failed) {
+        uninitialized_error(failed);
+    }
 }
 
-void ScopedSymbolTable::close_scope() {
-    if(scopes.size() == 1) {
-        cout << "Error: tried to close global scope" << endl;
-        exit(11);
-    }
-    scopes.pop_back();
+void Eval::uninitialized_error(Node* id) {
+    cout << format("symbol '{}' has not been initialized", names.name(id->sym)) << endl;
+    exit(9);
 }
@@ -0,0 +1,94 @@
+#pragma once
+#include "gavcc.h"
+#include "jit.h"
+#include "visitor.h"
+
+// Variable storage indexed by the slots SemAnal resolved. A slot is marked
+// uninitialized again every time its declaration is executed.
+class Frame {
+    vector<int64_t> values;
+    vector<uint8_t> initialized;
+public:
+    Frame(int32_t size): values(size), initialized(size) {}
+    void decl(int32_t slot) {
+        initialized[slot] = false;
+    }
+    void assn(int32_t slot, int64_t value) {
+        values[slot] = value;
+        initialized[slot] = true;
+    }
+    int64_t get(int32_t slot) {
+        return values[slot];
+    }
+    bool is_initialized(int32_t slot) {
+        return initialized[slot];
+    }
+    int64_t* values_data() {
+        return values.data();
+    }
+    uint8_t* initialized_data() {
+        return initialized.data();
+    }
+};
+
+// Statement visits run the statement, or open a block or loop
+class Eval : public NodeVisitor<Eval> {
+    friend class NodeVisitor<Eval>;
+    // Expression nodes on the way down to a leaf, see eval_expr
+    class Descent;
+    Node* ast;
+    const Interner& names;
+    Frame frame;
+    // Optional, hot loops are handed to it when set
+    Jit* jit;
+    // Blocks and loops being run, innermost last. Statements and
+    // expressions are walked with these explicit stacks rather than by
+    // recursion, so deep nesting can't overflow the call stack.
+    struct OpenStmt {
+        Node* node;
+        // Next statement of a block, or whether a loop's body has run
+        size_t next;
+        // Runs of a loop's body, or jit_failed once the JIT couldn't
+        // compile it, so it isn't looked up again until the loop is
+        // entered anew
+        int64_t iterations;
+    };
+    static constexpr int64_t jit_failed = -1;
+    vector<OpenStmt> open_stmts;
+    // Operators whose operands are being evaluated, innermost last
+    struct OpenExpr {
+        Node* node;
+        int64_t left;
+        bool has_left;
+    };
+    vector<OpenExpr> open_exprs;
+
+public:
+    Eval(Node* ast, const Interner& names, Jit* jit = nullptr):
+        ast(ast), names(names), frame(ast->frame_size), jit(jit) {}
+
+    int64_t eval() {
+        exec(ast);
+        return 0;
+    }
+
+private:
+    void exec(Node* root);
+    int64_t eval_expr(Node* root);
+
+    void visit_prgm(Node* cur);
+    void visit_block(Node* cur);
+    void visit_stmt_while(Node* cur);
+    void visit_stmt_decl(Node* cur);
+    void visit_stmt_assn(Node* cur);
+    void visit_stmt_return(Node* cur);
+
+    // Expressions are only reached through eval_expr
+    void visit_other(Node*) {}
+
+    // Finishes the current loop in machine code, starting from its condition
+    void run_jit_loop(JitLoop loop);
+
+    [[noreturn]]
+    void uninitialized_error(Node* id);
+};
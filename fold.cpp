@@ -0,0 +1,252 @@
+#include "fold.h"
+#include <algorithm>
+
+using i64 = int64_t;
+using u64 = uint64_t;
+using nt = NodeType;
+
+void Fold::fold() {
+    pending.push_back({ &ast, false });
+    while(!pending.empty()) {
+        Task task = pending.back();
+        pending.pop_back();
+        if(task.ready) {
+            finish(task.slot);
+            continue;
+        }
+        Node* cur = *task.slot;
+        switch(cur->type) {
+            case nt::prgm:
+            case nt::block:
+                for(size_t i = cur->stmts.size(); i-- > 0;) {
+                    pending.push_back({ &cur->stmts[i], false });
+                }
+                break;
+            case nt::stmt_while:
+                pending.push_back({ task.slot, true });
+                pending.push_back({ &cur->body, false });
+                pending.push_back({ &cur->expr, false });
+                break;
+            case nt::stmt_assn:
+            case nt::stmt_return:
+            case nt::paren_group:
+            case nt::unary_plus:
+            case nt::unary_minus:
+                pending.push_back({ task.slot, true });
+                pending.push_back({ &cur->expr, false });
+                break;
+            case nt::biop_plus:
+            case nt::biop_minus:
+            case nt::biop_mul:
+            case nt::biop_div:
+                pending.push_back({ task.slot, true });
+                pending.push_back({ &cur->right, false });
+                pending.push_back({ &cur->left, false });
+                break;
+            case nt::lit_int:
+                faults.push_back(false);
+                break;
+            case nt::lit_id:
+                faults.push_back(true);
+                break;
+            case nt::stmt_decl:
+                break;
+        }
+    }
+}
+
+void Fold::finish(Node** slot) {
+    Node* cur = *slot;
+    nt type = cur->type;
+    if(type == nt::stmt_while || type == nt::stmt_assn || type == nt::stmt_return) {
+        // Statements stay, their expression was folded in place
+        faults.pop_back();
+    }
+    else if(type == nt::paren_group) {
+        // Only compound expressions need the parentheses
+        if(is_unit(cur->expr)) {
+            *slot = cur->expr;
+        }
+    }
+    else if(type == nt::unary_plus) {
+        *slot = cur->expr;
+    }
+    else if(type == nt::unary_minus) {
+        Node* operand = cur->expr;
+        if(operand->type == nt::lit_int) {
+            make_int(cur, (i64)(0 - (u64)operand->ival));
+        }
+        else if(operand->type == nt::unary_minus) {
+            *slot = operand->expr;
+        }
+    }
+    else {
+        bool right_faults = faults.back();
+        faults.pop_back();
+        bool left_faults = faults.back();
+        faults.pop_back();
+        Node* left = cur->left;
+        Node* right = cur->right;
+        Node* folded = *slot = fold_biop(cur, left_faults, right_faults);
+        if(folded->type == nt::lit_int) {
+            faults.push_back(false);
+        }
+        else if(folded == left) {
+            faults.push_back(left_faults);
+        }
+        else if(folded == right) {
+            faults.push_back(right_faults);
+        }
+        else {
+            faults.push_back(left_faults || right_faults || type == nt::biop_div);
+        }
+    }
+}
+
+Node* Fold::fold_biop(Node* cur, bool left_faults, bool right_faults) {
+    nt type = cur->type;
+    Node* left = cur->left;
+    Node* right = cur->right;
+    if(left->type == nt::lit_int && right->type == nt::lit_int) {
+        return fold_constant(cur, left->ival, right->ival);
+    }
+    if(type == nt::biop_plus) {
+        if(is_int(left, 0)) {
+            return right;
+        }
+        if(is_int(right, 0)) {
+            return left;
+        }
+    }
+    else if(type == nt::biop_minus) {
+        if(is_int(right, 0)) {
+            return left;
+        }
+    }
+    else if(type == nt::biop_mul) {
+        if(is_int(left, 1)) {
+            return right;
+        }
+        if(is_int(right, 1)) {
+            return left;
+        }
+        if((is_int(left, 0) && !right_faults) || (is_int(right, 0) && !left_faults)) {
+            return make_int(cur, 0);
+        }
+    }
+    else if(type == nt::biop_div) {
+        if(is_int(right, 1)) {
+            return left;
+        }
+    }
+    return cur;
+}
+
+Node* Fold::fold_constant(Node* cur, i64 left, i64 right) {
+    switch(cur->type) {
+        case nt::biop_plus:
+            return make_int(cur, (i64)((u64)left + (u64)right));
+        case nt::biop_minus:
+            return make_int(cur, (i64)((u64)left - (u64)right));
+        case nt::biop_mul:
+            return make_int(cur, (i64)((u64)left * (u64)right));
+        case nt::biop_div:
+            if(right == 0 || (left == INT64_MIN && right == -1)) {
+                return cur;
+            }
+            return make_int(cur, left / right);
+    }
+    return cur;
+}
+
+Node* Fold::make_int(Node* cur, i64 value) {
+    cur->type = nt::lit_int;
+    cur->ival = value;
+    return cur;
+}
+
+bool Fold::is_unit(Node* cur) {
+    nt type = cur->type;
+    return type == nt::lit_int
+        || type == nt::lit_id
+        || type == nt::paren_group
+        || type == nt::unary_minus;
+}
+
+size_t count_nodes(Node* root) {
+    size_t count = 0;
+    vector<Node*> pending = { root };
+    while(!pending.empty()) {
+        Node* cur = pending.back();
+        pending.pop_back();
+        if(!cur) {
+            continue;
+        }
+        ++count;
+        switch(cur->type) {
+            case NodeType::prgm:
+            case NodeType::block:
+                pending.insert(pending.end(), cur->stmts.begin(), cur->stmts.end());
+                break;
+            case NodeType::stmt_while:
+                pending.push_back(cur->expr);
+                pending.push_back(cur->body);
+                break;
+            case NodeType::stmt_assn:
+            case NodeType::stmt_return:
+            case NodeType::paren_group:
+            case NodeType::unary_plus:
+            case NodeType::unary_minus:
+                pending.push_back(cur->expr);
+                break;
+            case NodeType::biop_plus:
+            case NodeType::biop_minus:
+            case NodeType::biop_mul:
+            case NodeType::biop_div:
+                pending.push_back(cur->left);
+                pending.push_back(cur->right);
+                break;
+        }
+    }
+    return count;
+}
+
+size_t tree_depth(Node* root) {
+    size_t max_depth = 0;
+    vector<std::pair<Node*, size_t>> pending = { { root, 1 } };
+    while(!pending.empty()) {
+        auto [cur, depth] = pending.back();
+        pending.pop_back();
+        if(!cur) {
+            continue;
+        }
+        max_depth = std::max(max_depth, depth);
+        switch(cur->type) {
+            case NodeType::prgm:
+            case NodeType::block:
+                for(Node* stmt : cur->stmts) {
+                    pending.push_back({ stmt, depth + 1 });
+                }
+                break;
+            case NodeType::stmt_while:
+                pending.push_back({ cur->expr, depth + 1 });
+                pending.push_back({ cur->body, depth + 1 });
+                break;
+            case NodeType::stmt_assn:
+            case NodeType::stmt_return:
+            case NodeType::paren_group:
+            case NodeType::unary_plus:
+            case NodeType::unary_minus:
+                pending.push_back({ cur->expr, depth + 1 });
+                break;
+            case NodeType::biop_plus:
+            case NodeType::biop_minus:
+            case NodeType::biop_mul:
+            case NodeType::biop_div:
+                pending.push_back({ cur->left, depth + 1 });
+                pending.push_back({ cur->right, depth + 1 });
+                break;
+        }
+    }
+    return max_depth;
+}
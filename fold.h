@@ -0,0 +1,54 @@
+#pragma once
+#include "gavcc.h"
+
+// Constant folding and algebraic simplification over a checked AST.
+// Rewrites the tree in place: constant subtrees become lit_int nodes and
+// identities like x*1, x+0 and --x collapse to their operand. Arithmetic
+// wraps like the generated code does. Anything that would fault at
+// runtime is left alone: division by a constant zero, INT64_MIN / -1, and
+// x*0 when x reads a variable (which might be uninitialized) or divides.
+//
+// The tree is walked in post order with an explicit stack, so nesting
+// depth is only bounded by memory. Whether each folded subtree can fault
+// is worked out on the way up, alongside its replacement.
+class Fold {
+    Node* ast;
+    // Where a node hangs, so its replacement can be put in its place, and
+    // whether its children are done
+    struct Task {
+        Node** slot;
+        bool ready;
+    };
+    vector<Task> pending;
+    // Whether evaluating each folded expression could stop the program,
+    // innermost last: reading a variable may hit an uninitialized slot
+    // and dividing may divide by zero
+    vector<bool> faults;
+
+public:
+    Fold(Node* ast): ast(ast) {}
+
+    void fold();
+
+private:
+    // Replaces the node at slot once its children are folded
+    void finish(Node** slot);
+    Node* fold_biop(Node* cur, bool left_faults, bool right_faults);
+    Node* fold_constant(Node* cur, int64_t left, int64_t right);
+
+    // Reuses cur as the literal so folding never allocates
+    Node* make_int(Node* cur, int64_t value);
+
+    bool is_int(Node* cur, int64_t value) {
+        return cur->type == NodeType::lit_int && cur->ival == value;
+    }
+
+    // Nodes that print as a single unit and never need parentheses
+    bool is_unit(Node* cur);
+};
+
+size_t count_nodes(Node* root);
+
+// Nodes on the longest path from root to a leaf. The backends that still
+// recurse over the tree check it against their limit up front.
+size_t tree_depth(Node* root);
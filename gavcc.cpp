@@ -1,55 +1,582 @@
 #include "gavcc.h"
-#include <filesystem>
+#include <chrono>
+#include <format>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
 
-#include "scanner.cpp"
-#include "parser.cpp"
-#include "semanal.cpp"
-#include "codegen.cpp"
-#include "eval.cpp"
-
-string ast_node_string(Node* ast);
-string ast_node_string_verbose(Node* ast);
-string node_type_string(NodeType type);
+#include "source.h"
+#include "scanner.h"
+#include "parser.h"
+#include "semanal.h"
+#include "fold.h"
+#include "codegen.h"
+#include "output.h"
+#include "jit.h"
+#include "eval.h"
+#include "bytecode.h"
+#include "closure.h"
+#include "regalloc.h"
+#include "asmgen.h"
+#include "ir.h"
+#include "incremental.h"
+#include "astfile.h"
+#include "cache.h"
+#include "batch.h"
+#include "report.h"
 
 using std::cout;
 using std::endl;
 
-std::string read_file(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Failed to open file: " + filename);
+enum class ExecMode {
+    tree,
+    bytecode,
+    // Tree walking with hot while loops compiled to machine code
+    jit,
+    // Interpreting the optimized SSA IR
+    ir,
+    // Calling closures compiled from the AST
+    closure,
+};
+
+struct Options {
+    string input = "test.c";
+    // Compile every input to C on a thread pool instead of running one
+    bool batch = false;
+    // Every positional argument, for --batch
+    vector<string> inputs;
+    // File listing more --batch inputs, one per line
+    string manifest;
+    size_t threads = std::thread::hardware_concurrency();
+    // Time the batch at 1, 2, 4... threads instead of printing it
+    bool bench_threads = false;
+    // Print per phase timings instead of the debug dumps, as a table or
+    // as JSON
+    bool time_report = false;
+    bool time_report_json = false;
+    // Number of edits for --bench-reparse, 0 to not run it
+    int bench_reparse = 0;
+    // Where --batch keeps compile results between runs, if anywhere
+    string cache_dir;
+    uint64_t cache_size = 64 << 20;
+    ExecMode exec = ExecMode::tree;
+    // Where to write the checked AST in binary form, if anywhere
+    string ast_output;
+    // Run a binary AST instead of compiling a source file
+    string ast_input;
+    // Where to write the generated C instead of the debug dump, if anywhere
+    string c_output;
+    // Where to write x86-64 assembly, if anywhere
+    string asm_output;
+    // Registers LinearScan may use for --emit-asm
+    int32_t asm_regs = AsmGen::pool_size;
+    // Iterations before a while loop is handed to the JIT
+    int64_t jit_threshold = 1000;
+    // Run constant folding after SemAnal
+    bool fold = false;
+    // Span kernels of the scanner
+    ScanSimd scan_simd = char_span::best();
+    // IR passes turned off with --disable-pass
+    vector<string> disabled_passes;
+};
+
+Options parse_args(int argc, char** argv) {
+    Options opts;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--exec=tree") {
+            opts.exec = ExecMode::tree;
+        }
+        else if(arg == "--exec=bytecode") {
+            opts.exec = ExecMode::bytecode;
+        }
+        else if(arg == "--exec=jit") {
+            opts.exec = ExecMode::jit;
+        }
+        else if(arg == "--exec=ir") {
+            opts.exec = ExecMode::ir;
+        }
+        else if(arg == "--exec=closure") {
+            opts.exec = ExecMode::closure;
+        }
+        else if(arg.starts_with("--disable-pass=")) {
+            opts.disabled_passes.push_back(arg.substr(string("--disable-pass=").size()));
+        }
+        else if(arg.starts_with("--jit-threshold=")) {
+            opts.jit_threshold = std::stoll(arg.substr(string("--jit-threshold=").size()));
+        }
+        else if(arg.starts_with("--scan-simd=")) {
+            string simd = arg.substr(string("--scan-simd=").size());
+            if(simd == "scalar") {
+                opts.scan_simd = ScanSimd::scalar;
+            }
+            else if(simd == "sse2") {
+                opts.scan_simd = ScanSimd::sse2;
+            }
+            else if(simd == "avx2") {
+                opts.scan_simd = ScanSimd::avx2;
+            }
+            else {
+                cout << "--scan-simd must be scalar, sse2 or avx2" << endl;
+                exit(1);
+            }
+            if(opts.scan_simd > char_span::best()) {
+                cout << "--scan-simd=" << simd << " is not supported by this CPU" << endl;
+                exit(1);
+            }
+        }
+        else if(arg == "--fold") {
+            opts.fold = true;
+        }
+        else if(arg.starts_with("--emit-c=")) {
+            opts.c_output = arg.substr(string("--emit-c=").size());
+        }
+        else if(arg.starts_with("--emit-asm=")) {
+            opts.asm_output = arg.substr(string("--emit-asm=").size());
+        }
+        else if(arg.starts_with("--emit-ast=")) {
+            opts.ast_output = arg.substr(string("--emit-ast=").size());
+        }
+        else if(arg.starts_with("--load-ast=")) {
+            opts.ast_input = arg.substr(string("--load-ast=").size());
+        }
+        else if(arg.starts_with("--regs=")) {
+            opts.asm_regs = std::stoi(arg.substr(string("--regs=").size()));
+            if(opts.asm_regs < 0 || opts.asm_regs > AsmGen::pool_size) {
+                cout << "--regs must be between 0 and " << AsmGen::pool_size << endl;
+                exit(1);
+            }
+        }
+        else if(arg == "--batch") {
+            opts.batch = true;
+        }
+        else if(arg.starts_with("--manifest=")) {
+            opts.manifest = arg.substr(string("--manifest=").size());
+            opts.batch = true;
+        }
+        else if(arg.starts_with("--threads=")) {
+            opts.threads = std::stoul(arg.substr(string("--threads=").size()));
+        }
+        else if(arg == "--time-report" || arg == "--time-report=table") {
+            opts.time_report = true;
+        }
+        else if(arg == "--time-report=json") {
+            opts.time_report = true;
+            opts.time_report_json = true;
+        }
+        else if(arg.starts_with("--bench-reparse=")) {
+            opts.bench_reparse = std::stoi(arg.substr(string("--bench-reparse=").size()));
+        }
+        else if(arg.starts_with("--cache-dir=")) {
+            opts.cache_dir = arg.substr(string("--cache-dir=").size());
+        }
+        else if(arg.starts_with("--cache-size=")) {
+            opts.cache_size = std::stoull(arg.substr(string("--cache-size=").size()));
+        }
+        else if(arg == "--bench-threads") {
+            opts.bench_threads = true;
+            opts.batch = true;
+        }
+        else if(arg.starts_with("--")) {
+            cout << "Unknown option: " << arg << endl;
+            exit(1);
+        }
+        else {
+            opts.input = arg;
+            opts.inputs.push_back(arg);
+        }
+    }
+    return opts;
+}
+
+// Prints each file's C, or its error, in the order the files were given.
+// Returns the exit code of the first file that failed. Cache statistics go
+// to stderr so the output is the same warm or cold.
+int run_batch(const vector<string>& paths, const Options& opts) {
+    std::unique_ptr<CompileCache> cache;
+    if(!opts.cache_dir.empty()) {
+        cache = std::make_unique<CompileCache>(opts.cache_dir, opts.cache_size);
+    }
+    vector<BatchResult> results = compile_batch(paths, opts.threads, opts.fold, cache.get());
+    if(cache) {
+        cache->evict();
+        std::cerr << std::format("cache: {} hits, {} misses, {} evicted",
+            cache->hits.load(), cache->misses.load(), cache->evictions.load()) << endl;
+    }
+    int code = 0;
+    OutputSink out(cout);
+    for(size_t i = 0; i < paths.size(); ++i) {
+        out.write("==> ");
+        out.write(paths[i]);
+        out.write(" <==\n");
+        out.write(results[i].output);
+        if(code == 0) {
+            code = results[i].code;
+        }
+    }
+    out.flush();
+    cout << std::flush;
+    return code;
+}
+
+// Wall time of the whole batch at 1, 2, 4... threads up to --threads,
+// best of three runs each
+void bench_threads(const vector<string>& paths, const Options& opts) {
+    vector<size_t> counts;
+    for(size_t n = 1; n < opts.threads; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(opts.threads);
+    double base = 0;
+    cout << "threads  seconds  files/s  speedup" << endl;
+    for(size_t n : counts) {
+        double best = 0;
+        for(int run = 0; run < 3; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            compile_batch(paths, n, opts.fold);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if(run == 0 || seconds < best) {
+                best = seconds;
+            }
+        }
+        if(n == 1) {
+            base = best;
+        }
+        cout << std::format("{:7}  {:7.3f}  {:7.0f}  {:6.2f}x", n, best, paths.size() / best, base / best) << endl;
+    }
+}
+
+// Parses text from scratch, returning the AST dump, or the error message
+// if it doesn't parse
+string parse_from_scratch(const string& text, bool dump) {
+    throw_compile_errors = true;
+    string result;
+    try {
+        Interner names;
+        Scanner scanner(text, names);
+        Arena arena;
+        Parser parser(scanner, arena);
+        Node* ast = parser.parse();
+        if(dump) {
+            result = to_string::node(ast, names);
+        }
     }
+    catch(const CompileError& error) {
+        result = error.msg;
+    }
+    throw_compile_errors = false;
+    return result;
+}
 
-    std::string content;
-    content.resize(std::filesystem::file_size(filename));
-    file.read(content.data(), content.size());
-    return content;
+// Finds what bench_reparse's structural edits insert, from at on and then
+// from the start. Only right after a ';', where removing it always leaves
+// a program that parses.
+size_t find_after_stmt(const string& text, const string& what, size_t at) {
+    for(size_t from : { at, (size_t)0 }) {
+        for(size_t pos = text.find(what, from); pos != string::npos; pos = text.find(what, pos + 1)) {
+            if(pos > 0 && text[pos - 1] == ';') {
+                return pos;
+            }
+        }
+    }
+    return string::npos;
 }
 
-int main() {
-    string s = read_file("test.c");
+// Applies random edits to the input through IncrementalParser and compares
+// the time per edit against parsing the edited file from scratch. The
+// edits cycle through changing a digit of an integer literal, appending
+// " + 7" to one, inserting " } {" after a statement in a block, or " {}"
+// after one at the top level, and removing one of those again. The
+// statements around a " } {" don't parse on their own, so it takes the
+// fallback to reparsing the list around the block. The incremental tree,
+// or its parse error, is checked against a full parse, after every edit
+// for small inputs and less often the bigger the input.
+void bench_reparse(const string& input, int edits) {
+    using clock = std::chrono::steady_clock;
+    // Kept alongside the parser to pick edits and check its trees
+    string text = read_file(input);
+    IncrementalParser parser(text);
+    if(!parser.root()) {
+        cout << parser.error() << endl;
+        exit(1);
+    }
+    int check_every = std::max<size_t>(1, text.size() / 4000);
+    std::mt19937 rng(1);
+    double incremental_seconds = 0;
+    double full_seconds = 0;
+    int full_runs = 0;
+    double sem_anal_seconds = 0;
+    int sem_anal_runs = 0;
+    for(int i = 0; i < edits; ++i) {
+        size_t at = rng() % text.size();
+        TextEdit edit;
+        size_t found = string::npos;
+        if(i % 4 == 2 && (found = text.find(';', at)) != string::npos) {
+            bool in_block = std::count(text.begin(), text.begin() + found, '{')
+                > std::count(text.begin(), text.begin() + found, '}');
+            edit = { found + 1, 0, in_block ? " } {" : " {}" };
+        }
+        else if(i % 4 == 3 && ((found = find_after_stmt(text, " } {", at)) != string::npos
+                || (found = find_after_stmt(text, " {}", at)) != string::npos)) {
+            edit = { found, text[found + 1] == '}' ? 4u : 3u, "" };
+        }
+        else {
+            size_t digit = text.find_first_of("0123456789", at);
+            if(digit == string::npos) {
+                digit = text.find_first_of("0123456789");
+            }
+            if(digit == string::npos) {
+                cout << "No integer literals to edit" << endl;
+                exit(1);
+            }
+            if(i % 2 == 0) {
+                edit = { digit, 1, text[digit] == '7' ? "3" : "7" };
+            }
+            else {
+                size_t number_end = text.find_first_not_of("0123456789", digit);
+                edit = { number_end == string::npos ? text.size() : number_end, 0, " + 7" };
+            }
+        }
+
+        auto start = clock::now();
+        parser.edit(edit);
+        incremental_seconds += std::chrono::duration<double>(clock::now() - start).count();
+        text.replace(edit.offset, edit.removed, edit.inserted);
+
+        if(i < 20) {
+            start = clock::now();
+            parse_from_scratch(text, false);
+            full_seconds += std::chrono::duration<double>(clock::now() - start).count();
+            ++full_runs;
+        }
+        if(i % check_every == 0 || i == edits - 1) {
+            string incremental = parser.root() ? to_string::node(parser.root(), parser.interner()) : parser.error();
+            if(incremental != parse_from_scratch(text, true) || parser.source() != text) {
+                cout << "reparse: tree differs from a full parse after edit " << i << endl;
+                exit(1);
+            }
+        }
+        // Splitting a block can move a declaration away from its uses, so
+        // only the runs that pass are timed
+        if((i % 100 == 0 || i == edits - 1) && parser.root()) {
+            throw_compile_errors = true;
+            try {
+                start = clock::now();
+                SemAnal sem_anal(parser.root(), parser.interner());
+                sem_anal.sem_anal();
+                sem_anal_seconds += std::chrono::duration<double>(clock::now() - start).count();
+                ++sem_anal_runs;
+            }
+            catch(const CompileError&) {
+            }
+            throw_compile_errors = false;
+        }
+    }
+    double incremental_us = incremental_seconds / edits * 1e6;
+    double full_us = full_seconds / full_runs * 1e6;
+    cout << std::format("reparse: {} edits, {} incremental, {} full parses, {} block fallbacks",
+        edits, parser.incremental_edits, parser.full_parses, parser.block_fallbacks) << endl;
+    cout << std::format("incremental edit   {:10.1f} us", incremental_us) << endl;
+    cout << std::format("full parse         {:10.1f} us", full_us) << endl;
+    cout << std::format("speedup            {:10.1f}x", full_us / incremental_us) << endl;
+    if(sem_anal_runs > 0) {
+        cout << std::format("SemAnal, all nodes {:10.1f} us", sem_anal_seconds / sem_anal_runs * 1e6) << endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options opts = parse_args(argc, argv);
+    if(opts.batch) {
+        vector<string> paths = opts.inputs;
+        if(!opts.manifest.empty()) {
+            vector<string> listed = read_manifest(opts.manifest);
+            paths.insert(paths.end(), listed.begin(), listed.end());
+        }
+        if(opts.bench_threads) {
+            bench_threads(paths, opts);
+            return 0;
+        }
+        return run_batch(paths, opts);
+    }
+    if(opts.bench_reparse > 0) {
+        bench_reparse(opts.input, opts.bench_reparse);
+        return 0;
+    }
+    if(!opts.ast_input.empty()) {
+        AstFile file(opts.ast_input);
+        if(!opts.time_report) {
+            cout << to_string::flat_node(file, file.root()) << endl;
+        }
+        FlatEval flat_eval(file);
+        flat_eval.eval();
+        return 0;
+    }
+
+    // The debug dumps would swamp the phases being timed
+    bool dump = !opts.time_report;
+    TimeReport report;
+    report.input = opts.input;
 
-    cout << s << endl;
+    report.start("read");
+    SourceFile source(opts.input);
+    std::string_view s = source.text();
+    report.stop();
 
-    Scanner scanner(s);
-    vector<Token> tokens = scanner.scan();
-    cout << to_string::tokens(tokens) << endl;
+    if(dump) {
+        cout << s << endl;
+    }
 
-    Parser parser(tokens);
+    Interner names;
+    report.start("scan");
+    vector<Token> tokens = Scanner(s, names, opts.scan_simd).scan();
+    report.stop();
+    report.tokens = tokens.size();
+    if(dump) {
+        cout << to_string::tokens(tokens) << endl;
+    }
+
+    // The parser pulls its own tokens, so this includes scanning again
+    report.start("parse");
+    Scanner scanner(s, names, opts.scan_simd);
+    Arena arena;
+    Parser parser(scanner, arena);
     Node* ast = parser.parse();
-    cout << to_string::node(ast) << endl;
+    report.stop();
+    report.nodes = count_nodes(ast);
+    if(dump) {
+        cout << to_string::node(ast, names) << endl;
+    }
 
-    SemAnal sem_anal(ast);
+    report.start("semanal");
+    SemAnal sem_anal(ast, names);
     sem_anal.sem_anal();
+    report.stop();
+
+    if(opts.fold) {
+        size_t before = count_nodes(ast);
+        report.start("fold");
+        Fold fold(ast);
+        fold.fold();
+        report.stop();
+        cout << "fold: " << before << " -> " << count_nodes(ast) << " nodes" << endl;
+    }
+
+    if(!opts.ast_output.empty()) {
+        report.start("emit-ast");
+        write_ast_file(opts.ast_output, ast, names);
+        report.stop();
+    }
+
+    // Streamed to its destination, without the whole program in memory.
+    // Timing runs without --emit-c still generate it, into nothing.
+    report.start("codegen");
+    if(!opts.c_output.empty()) {
+        int fd = open(opts.c_output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            cout << "Failed to open " << opts.c_output << endl;
+            exit(1);
+        }
+        OutputSink sink(fd);
+        CodeGen(ast, names, sink).code_gen();
+        sink.flush();
+        if(!sink || close(fd) != 0) {
+            cout << "Failed to write " << opts.c_output << endl;
+            exit(1);
+        }
+    }
+    else if(dump) {
+        OutputSink sink(cout);
+        CodeGen(ast, names, sink).code_gen();
+    }
+    else {
+        OutputSink sink;
+        CodeGen(ast, names, sink).code_gen();
+    }
+    report.stop();
+
+    if(!opts.asm_output.empty()) {
+        report.start("asm");
+        Chunk chunk = BytecodeGen(ast, false).gen();
+        RegAlloc alloc = LinearScan(chunk, opts.asm_regs).alloc();
+        AsmGen asm_gen(chunk, alloc, names);
+        std::ofstream asm_file(opts.asm_output);
+        asm_file << asm_gen.asm_gen();
+        report.stop();
+        if(dump) {
+            cout << to_string::reg_alloc(alloc) << endl;
+        }
+    }
 
-    CodeGen code_gen(ast);
-    string out = code_gen.code_gen();
-    cout << out;
+    if(opts.exec == ExecMode::bytecode) {
+        report.start("bytecode");
+        BytecodeGen bytecode_gen(ast);
+        Chunk chunk = bytecode_gen.gen();
+        report.stop();
+        if(dump) {
+            cout << to_string::chunk(chunk) << endl;
+        }
 
-    Eval eval(ast);
-    eval.eval();
+        report.start("eval");
+        VM vm(chunk, names);
+        vm.run();
+        report.stop();
+    }
+    else if(opts.exec == ExecMode::ir) {
+        report.start("ir");
+        IrBuilder ir_builder(ast);
+        IrFunc func = ir_builder.build();
+        PassManager pass_manager;
+        for(const string& pass : opts.disabled_passes) {
+            if(!pass_manager.set_enabled(pass, false)) {
+                cout << "Unknown pass: " << pass << endl;
+                exit(1);
+            }
+        }
+        pass_manager.run(func);
+        report.stop();
+        if(dump) {
+            cout << to_string::ir_func(func, names) << endl;
+            cout << pass_manager.timing_report() << endl;
+        }
+
+        report.start("eval");
+        IrEval ir_eval(func, names);
+        ir_eval.eval();
+        report.stop();
+    }
+    else if(opts.exec == ExecMode::closure) {
+        report.start("closure");
+        ClosureGen closure_gen(ast);
+        const ClosureStmt* program = closure_gen.gen();
+        report.stop();
+
+        report.start("eval");
+        ClosureEval closure_eval(program, ast->frame_size, names);
+        closure_eval.eval();
+        report.stop();
+    }
+    else if(opts.exec == ExecMode::jit) {
+        report.start("eval");
+        Jit jit(opts.jit_threshold);
+        Eval eval(ast, names, &jit);
+        eval.eval();
+        report.stop();
+    }
+    else {
+        report.start("eval");
+        Eval eval(ast, names);
+        eval.eval();
+        report.stop();
+    }
+
+    // On stderr, after the program's own output
+    if(opts.time_report) {
+        cout << std::flush;
+        std::cerr << (opts.time_report_json ? report.json() : report.table()) << std::flush;
+    }
 
     return 0;
 }
@@ -1,6 +1,13 @@
 #pragma once
-#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 template <typename T>
 using vector = std::vector<T>;
 using string = std::string;
@@ -28,11 +35,16 @@ enum class TokenType {
     eof,
 };
 
+// Interned identifier, an index into an Interner
+using SymId = uint32_t;
+
 struct Token {
     TokenType type;
-    string lexeme;
+    // Interned identifier for id tokens
+    SymId sym;
+    // View into the source buffer
+    std::string_view lexeme;
     int64_t ival;
-    string id;
 };
 
 enum class NodeType {
@@ -55,182 +67,130 @@ enum class NodeType {
 
 struct Node {
     NodeType type;
-    Token token;
-    vector<Node*> stmts;
-    Node* body;
+    // Identifier for stmt_decl, stmt_assn and lit_id
+    SymId sym;
+    // Frame slot of the variable, resolved by SemAnal
+    int32_t slot = -1;
+    // Number of slots needed by the whole program, set on the prgm node
+    int32_t frame_size = 0;
     int64_t ival;
-    string id;
+    std::span<Node*> stmts;
+    Node* body;
     Node* expr;
     Node* left;
     Node* right;
 };
 
+// Bump allocator that owns every Node of a program. Memory is handed out
+// from large blocks and only released when the arena is destroyed, so
+// allocation is a pointer increment and nodes end up next to each other.
+class Arena {
+    static constexpr size_t block_size = 64 * 1024;
+    vector<std::unique_ptr<std::byte[]>> blocks;
+    std::byte* next = nullptr;
+    size_t left = 0;
+    size_t used = 0;
 
-namespace to_string {
-    string token_type(TokenType type);
-    string token(Token token);
-    string tokens(vector<Token> tokens);
-    string node_type(NodeType type);
-    string node(Node* node, string indent="");
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    template <typename T>
+    T* make() {
+        return new (alloc(sizeof(T), alignof(T))) T();
+    }
 
-    string tokens(vector<Token> tokens) {
-        string s;
-        for(Token token : tokens) {
-            s += to_string::token(token) + " ";
+    template <typename T>
+    std::span<T> make_array(const vector<T>& items) {
+        if(items.empty()) {
+            return {};
         }
-        return s;
+        T* array = static_cast<T*>(alloc(sizeof(T) * items.size(), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), array);
+        return { array, items.size() };
     }
 
-    string token(Token token) {
-        return to_string::token_type(token.type);
+    size_t bytes_used() const {
+        return used;
     }
 
-    string token_type(TokenType type) {
-        switch(type) {
-            case TokenType::kw_int:
-                return "kw:int";
-            case TokenType::kw_return:
-                return "kw:return";
-            case TokenType::kw_while:
-                return "kw:while";
-            case TokenType::id:
-                return "id";
-            case TokenType::lbrace:
-                return "{";
-            case TokenType::rbrace:
-                return "}";
-            case TokenType::lparen:
-                return "(";
-            case TokenType::rparen:
-                return ")";
-            case TokenType::integer:
-                return "<int>";
-            case TokenType::plus:
-                return "+";
-            case TokenType::minus:
-                return "-";
-            case TokenType::star:
-                return "*";
-            case TokenType::div:
-                return "/";
-            case TokenType::equal:
-                return "=";
-            case TokenType::semicolon:
-                return ";";
-            case TokenType::eof:
-                return "EOF";
+private:
+    void* alloc(size_t size, size_t align) {
+        size_t pad = -reinterpret_cast<uintptr_t>(next) & (align - 1);
+        if(pad + size > left) {
+            size_t new_size = size > block_size ? size : block_size;
+            blocks.push_back(std::make_unique<std::byte[]>(new_size));
+            next = blocks.back().get();
+            left = new_size;
+            pad = 0;
         }
-        return "[UNIMP]";
+        void* result = next + pad;
+        next += pad + size;
+        left -= pad + size;
+        used += pad + size;
+        return result;
     }
+};
 
-    string node(Node* node, string indent) {
-        NodeType type = node->type;
-        string s;
-        s += indent + to_string::node_type(type) + ": ";
-        switch(type) {
-            case NodeType::lit_int:
-                s += std::to_string(node->token.ival) + "\n";
-                return s;
-            case NodeType::lit_id:
-                s += node->token.id + "\n";
-                return s;
+// Gives every distinct identifier a small, stable id. The scanner interns
+// each identifier once, and every later pass of the same compilation
+// shares the interner and compares ids instead of strings.
+class Interner {
+    // Lets the map be probed with a string_view without building a string
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view sv) const {
+            return std::hash<std::string_view>{}(sv);
         }
-        s += "\n";
-        indent += "    ";
-        switch(type) {
-            case NodeType::prgm: 
-                for(Node* stmt : node->stmts) {
-                    s += to_string::node(stmt, indent);
-                }
-                return s;
-            case NodeType::block:
-                for(Node* stmt : node->stmts) {
-                    s += to_string::node(stmt, indent);
-                }
-                return s;
-            case NodeType::stmt_decl:
-                s += indent + "name: " + node->id + "\n";
-                return s;
-            case NodeType::stmt_assn:
-                s += indent + "name: " + node->id + "\n";
-                s += indent  + "expr:\n";
-                indent += "    ";
-                s += to_string::node(node->expr, indent);
-                return s;
-            case NodeType::stmt_return:
-                s += indent + "expr:\n";
-                indent += "    ";
-                s += to_string::node(node->expr, indent);
-                return s;
-            case NodeType::stmt_while:
-                s += indent + "while:\n";
-                indent += "    ";
-                s += to_string::node(node->expr, indent);
-                s += indent + "stmts:\n";
-                s += to_string::node(node->body, indent);
-                return s;
-            case NodeType::paren_group:
-                s += to_string::node(node->expr, indent);
-                return s;
-            case NodeType::biop_plus:
-                s += to_string::node(node->left, indent);
-                s += to_string::node(node->right, indent);
-                return s;
-            case NodeType::biop_minus:
-                s += to_string::node(node->left, indent);
-                s += to_string::node(node->right, indent);
-                return s;
-            case NodeType::biop_mul:
-                s += to_string::node(node->left, indent);
-                s += to_string::node(node->right, indent);
-                return s;
-            case NodeType::biop_div:
-                s += to_string::node(node->left, indent);
-                s += to_string::node(node->right, indent);
-                return s;
-            case NodeType::unary_plus:
-                s += to_string::node(node->expr, indent);
-                return s;
-            case NodeType::unary_minus:
-                s += to_string::node(node->expr, indent);
-                return s;
+    };
+    std::unordered_map<string, SymId, Hash, std::equal_to<>> ids;
+    vector<string> names;
+
+public:
+    SymId intern(std::string_view name) {
+        auto it = ids.find(name);
+        if(it != ids.end()) {
+            return it->second;
         }
-        return "UNRECOG NODE";
+        SymId id = names.size();
+        ids.emplace(string(name), id);
+        names.emplace_back(name);
+        return id;
     }
 
-    string node_type(NodeType type) {
-        switch(type) {
-            case NodeType::prgm:
-                return "prgm";
-            case NodeType::block:
-                return "block";
-            case NodeType::stmt_decl:
-                return "stmt:decl";
-            case NodeType::stmt_assn:
-                return "stmt:assn";
-            case NodeType::stmt_return:
-                return "stmt:return";
-            case NodeType::stmt_while:
-                return "stmt:while";
-            case NodeType::paren_group:
-                return "paren_group";
-            case NodeType::biop_plus:
-                return "biop_plus";
-            case NodeType::biop_minus:
-                return "biop:minus";
-            case NodeType::biop_mul:
-                return "biop:mul";
-            case NodeType::biop_div:
-                return "biop:div";
-            case NodeType::unary_plus:
-                return "unary:plus";
-            case NodeType::unary_minus:
-                return "unary:minus";
-            case NodeType::lit_int:
-                return "lit:int";
-            case NodeType::lit_id:
-                return "lit:id";
-        }
-        return "UNRECOG NODE TYPE";
+    const string& name(SymId id) const {
+        return names[id];
     }
+
+    size_t size() const {
+        return names.size();
+    }
+};
+
+// A front end error: a parse error or a failed semantic check. Normally it
+// is printed and ends the process with code, threads that compile many
+// files turn on throw_compile_errors and catch it per file instead.
+struct CompileError {
+    string msg;
+    int code;
+};
+
+inline thread_local bool throw_compile_errors = false;
+
+[[noreturn]]
+inline void compile_error(string msg, int code) {
+    if(throw_compile_errors) {
+        throw CompileError{ std::move(msg), code };
+    }
+    std::cout << msg << std::endl;
+    exit(code);
+}
+
+namespace to_string {
+    string token_type(TokenType type);
+    string token(Token token);
+    string tokens(vector<Token> tokens);
+    string node_type(NodeType type);
+    string node(Node* node, const Interner& names, string indent="");
 }
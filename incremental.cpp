@@ -0,0 +1,279 @@
+#include "incremental.h"
+#include <algorithm>
+#include <cstring>
+
+ChunkedText::ChunkedText(std::string_view text) {
+    chunks.push_back("");
+    starts.push_back(0);
+    replace(0, 0, text);
+}
+
+void ChunkedText::replace(size_t offset, size_t removed, std::string_view inserted) {
+    size_t first = chunk_of(offset);
+    size_t last = chunk_of(offset + removed);
+    string joined = chunks[first].substr(0, offset - starts[first]);
+    joined += inserted;
+    joined += std::string_view(chunks[last]).substr(offset + removed - starts[last]);
+    // Half full chunks leave room for the next few edits
+    vector<string> pieces;
+    size_t pos = 0;
+    while(joined.size() - pos > max_chunk) {
+        pieces.push_back(joined.substr(pos, max_chunk / 2));
+        pos += max_chunk / 2;
+    }
+    if(pos < joined.size() || chunks.size() == last - first + 1) {
+        pieces.push_back(joined.substr(pos));
+    }
+    chunks.erase(chunks.begin() + first, chunks.begin() + last + 1);
+    chunks.insert(chunks.begin() + first, std::make_move_iterator(pieces.begin()), std::make_move_iterator(pieces.end()));
+    starts.resize(chunks.size());
+    for(size_t i = first; i < chunks.size(); ++i) {
+        starts[i] = i == 0 ? 0 : starts[i - 1] + chunks[i - 1].size();
+    }
+    total = starts.back() + chunks.back().size();
+}
+
+void ChunkedText::copy(size_t start, size_t end, string& out) const {
+    out.clear();
+    for(size_t i = chunk_of(start); i < chunks.size() && starts[i] < end; ++i) {
+        size_t from = std::max(start, starts[i]) - starts[i];
+        size_t to = std::min(end, starts[i] + chunks[i].size()) - starts[i];
+        out.append(chunks[i], from, to - from);
+    }
+}
+
+string ChunkedText::str() const {
+    string out;
+    copy(0, total, out);
+    return out;
+}
+
+// The spans of one statement list. After an edit every statement behind
+// it moves, which is the one part of an edit that grows with the list
+// rather than the edit. Block lists are short and just get their offsets
+// bumped. The top level list can be the whole file, so it keeps the
+// moves in a Fenwick tree instead: statement i has moved by the sum of
+// the first i + 1 entries, and moving a suffix is a logarithmic update.
+// Offsets are uint32_t and the sums are taken modulo 2^32, so a stored
+// offset may wrap as long as the total comes out right.
+class SpanList {
+    vector<StmtSpan>& spans;
+    // Null for lists that are moved in place
+    vector<int64_t>* moves;
+
+public:
+    SpanList(vector<StmtSpan>& spans, vector<int64_t>* moves = nullptr): spans(spans), moves(moves) {}
+
+    size_t size() const {
+        return spans.size();
+    }
+
+    StmtSpan& operator[](size_t i) {
+        return spans[i];
+    }
+
+    uint32_t start(size_t i) const {
+        return spans[i].start + moved(i);
+    }
+
+    uint32_t end(size_t i) const {
+        return spans[i].end + moved(i);
+    }
+
+    // First index from lo on where pred(index) is false, pred must be
+    // true and then false over the list
+    template <typename F>
+    size_t partition_point(F pred, size_t lo) const {
+        size_t hi = spans.size();
+        while(lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if(pred(mid)) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // Moves statements from on by delta
+    void move(size_t from, int64_t delta) {
+        if(moves) {
+            for(size_t i = from + 1; i < moves->size(); i += i & -i) {
+                (*moves)[i] += delta;
+            }
+            return;
+        }
+        for(size_t i = from; i < spans.size(); ++i) {
+            spans[i].start += delta;
+            spans[i].end += delta;
+        }
+    }
+
+    // Puts replacement, in current offsets, in place of [first, last) and
+    // moves the statements after it by delta
+    void replace(size_t first, size_t last, vector<StmtSpan>& replacement, int64_t delta) {
+        if(replacement.size() == last - first) {
+            for(size_t i = first; i < last; ++i) {
+                StmtSpan& span = replacement[i - first];
+                uint32_t offset = moved(i);
+                span.start -= offset;
+                span.end -= offset;
+                spans[i] = std::move(span);
+            }
+            move(last, delta);
+            return;
+        }
+        // Inserting or removing statements shifts the indexes, so fold
+        // the pending moves back into the offsets and start over
+        if(moves) {
+            for(size_t i = 0; i < spans.size(); ++i) {
+                uint32_t offset = moved(i);
+                spans[i].start += offset;
+                spans[i].end += offset;
+            }
+            moves->assign(spans.size() + replacement.size() - (last - first) + 1, 0);
+        }
+        spans.erase(spans.begin() + first, spans.begin() + last);
+        spans.insert(spans.begin() + first, std::make_move_iterator(replacement.begin()), std::make_move_iterator(replacement.end()));
+        for(size_t i = first + replacement.size(); i < spans.size(); ++i) {
+            spans[i].start += delta;
+            spans[i].end += delta;
+        }
+    }
+
+private:
+    uint32_t moved(size_t i) const {
+        if(!moves) {
+            return 0;
+        }
+        int64_t sum = 0;
+        for(size_t j = i + 1; j > 0; j -= j & -j) {
+            sum += (*moves)[j];
+        }
+        return sum;
+    }
+};
+
+void IncrementalParser::edit(const TextEdit& edit) {
+    size_t old_size = text.size();
+    text.replace(edit.offset, edit.removed, edit.inserted);
+    has_nul = has_nul || memchr(edit.inserted.data(), 0, edit.inserted.size());
+    if(ast && !has_nul && arena->bytes_used() < arena_limit
+        && reparse_list(ast, SpanList(spans, &moves), 0, 0, old_size, edit)) {
+        ++incremental_edits;
+        error_msg.clear();
+        return;
+    }
+    full_parse();
+}
+
+void IncrementalParser::full_parse() {
+    ++full_parses;
+    arena = std::make_unique<Arena>();
+    spans.clear();
+    ast = nullptr;
+    error_msg.clear();
+    vector<Node*> stmts;
+    bool parsed = parse_region(0, text.size(), stmts, spans);
+    has_nul = memchr(scratch.data(), 0, scratch.size());
+    if(!parsed) {
+        return;
+    }
+    moves.assign(spans.size() + 1, 0);
+    ast = arena->make<Node>();
+    ast->type = NodeType::prgm;
+    ast->stmts = arena->make_array(stmts);
+    arena_limit = arena->bytes_used() * 4 + (1 << 20);
+}
+
+bool IncrementalParser::parse_region(size_t start, size_t end, vector<Node*>& stmts, vector<StmtSpan>& out) {
+    text.copy(start, end, scratch);
+    bool throws = throw_compile_errors;
+    throw_compile_errors = true;
+    try {
+        Scanner scanner(scratch, names);
+        Parser parser(scanner, *arena);
+        stmts = parser.parse_stmts(scratch.data(), out);
+    }
+    catch(const CompileError& error) {
+        error_msg = error.msg;
+        throw_compile_errors = throws;
+        return false;
+    }
+    throw_compile_errors = throws;
+    return true;
+}
+
+bool IncrementalParser::reparse_list(Node* owner, SpanList list, size_t base, size_t lo, size_t hi, const TextEdit& edit) {
+    size_t edit_start = edit.offset;
+    size_t edit_end = edit.offset + edit.removed;
+    int64_t delta = (int64_t)edit.inserted.size() - (int64_t)edit.removed;
+
+    // Statements that overlap or touch the edit, touching ones too
+    // since the edit may glue a token onto them
+    size_t first = list.partition_point([&](size_t i) {
+        return base + list.end(i) < edit_start;
+    }, 0);
+    size_t last = list.partition_point([&](size_t i) {
+        return base + list.start(i) <= edit_end;
+    }, first);
+
+    if(last - first == 1) {
+        StmtSpan& stmt = list[first];
+        size_t stmt_base = base + list.start(first);
+        // The block is either the statement or the body of a while
+        StmtSpan* block = nullptr;
+        size_t block_base = stmt_base;
+        size_t block_end = base + list.end(first);
+        if(stmt.node->type == NodeType::block) {
+            block = &stmt;
+        }
+        else if(stmt.node->type == NodeType::stmt_while && stmt.inner[0].node->type == NodeType::block) {
+            // The body's span is relative to the while
+            block = &stmt.inner[0];
+            block_base = stmt_base + block->start;
+            block_end = stmt_base + block->end;
+        }
+        // Inside the braces, without removing either of them
+        if(block && edit_start > block_base && edit_end < block_end) {
+            if(reparse_list(block->node, SpanList(block->inner), block_base, block_base + 1, block_end - 1, edit)) {
+                if(block != &stmt) {
+                    block->end += delta;
+                }
+                stmt.end += delta;
+                list.move(first + 1, delta);
+                return true;
+            }
+            ++block_fallbacks;
+        }
+    }
+
+    // Reparse from the end of the last untouched statement before the
+    // edit to the start of the first one after it
+    size_t start = first > 0 ? base + list.end(first - 1) : lo;
+    size_t end = (last < list.size() ? base + list.start(last) : hi) + delta;
+    vector<Node*> stmts;
+    vector<StmtSpan> new_spans;
+    if(!parse_region(start, end, stmts, new_spans)) {
+        return false;
+    }
+    for(StmtSpan& span : new_spans) {
+        span.start += start - base;
+        span.end += start - base;
+    }
+    // The usual edit keeps the number of statements, which lets the
+    // owner's array be patched in place
+    bool same_count = stmts.size() == last - first;
+    list.replace(first, last, new_spans, delta);
+    if(same_count) {
+        std::copy(stmts.begin(), stmts.end(), owner->stmts.begin() + first);
+        return true;
+    }
+    vector<Node*> owner_stmts(owner->stmts.begin(), owner->stmts.begin() + first);
+    owner_stmts.insert(owner_stmts.end(), stmts.begin(), stmts.end());
+    owner_stmts.insert(owner_stmts.end(), owner->stmts.begin() + last, owner->stmts.end());
+    owner->stmts = arena->make_array(owner_stmts);
+    return true;
+}
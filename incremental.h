@@ -0,0 +1,118 @@
+#pragma once
+#include "gavcc.h"
+#include "parser.h"
+#include <algorithm>
+
+// Replace removed bytes at offset with inserted
+struct TextEdit {
+    size_t offset;
+    size_t removed;
+    std::string_view inserted;
+};
+
+// Source text split into chunks of at most max_chunk bytes, so an edit
+// only rewrites the chunks it touches instead of moving the whole file
+class ChunkedText {
+    static constexpr size_t max_chunk = 16384;
+    vector<string> chunks;
+    // Offset of each chunk
+    vector<size_t> starts;
+    size_t total = 0;
+
+public:
+    ChunkedText(std::string_view text);
+
+    size_t size() const {
+        return total;
+    }
+
+    void replace(size_t offset, size_t removed, std::string_view inserted);
+
+    // Replaces out with the text in [start, end)
+    void copy(size_t start, size_t end, string& out) const;
+    string str() const;
+
+private:
+    // The chunk holding offset, or the last one for the end of the text
+    size_t chunk_of(size_t offset) const {
+        return std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+    }
+};
+
+// One statement list being reparsed, see incremental.cpp
+class SpanList;
+
+// Keeps a source file parsed across edits. Every statement remembers where
+// it is (see StmtSpan), so an edit walks down into the innermost block
+// that contains it and only rescans and reparses the statements the edit
+// touches, plus the whitespace around them. The rest of the tree is
+// reused as is. When that stretch of text doesn't parse on its own, say a
+// brace was deleted, the enclosing statement is reparsed instead, and so
+// on out to the whole file.
+//
+// Replaced nodes stay in the arena, so after enough edits the whole file
+// is reparsed into a fresh one.
+//
+// Only parsing is incremental. After an edit root() mixes reused nodes,
+// whose slots SemAnal filled in before, with fresh unchecked ones, and
+// declarations may have moved between scopes. SemAnal has to run over the
+// whole tree again before anything reads slots.
+class IncrementalParser {
+    ChunkedText text;
+    // Holds the text being parsed
+    string scratch;
+    Interner names;
+    std::unique_ptr<Arena> arena;
+    Node* ast = nullptr;
+    vector<StmtSpan> spans;
+    // Fenwick tree of moves for the top level spans, see SpanList
+    vector<int64_t> moves;
+    // A NUL ends the scan early, which region reparsing can't account for
+    bool has_nul = false;
+    size_t arena_limit = 0;
+    string error_msg;
+
+public:
+    size_t incremental_edits = 0;
+    size_t full_parses = 0;
+    // Edits inside a block whose statements didn't parse on their own, so
+    // the list around the block was reparsed instead
+    size_t block_fallbacks = 0;
+
+    IncrementalParser(std::string_view text): text(text) {
+        full_parse();
+    }
+
+    void edit(const TextEdit& edit);
+
+    // nullptr while the text doesn't parse
+    Node* root() const {
+        return ast;
+    }
+
+    const Interner& interner() const {
+        return names;
+    }
+
+    string source() const {
+        return text.str();
+    }
+
+    // Why the last full parse failed
+    const string& error() const {
+        return error_msg;
+    }
+
+private:
+    void full_parse();
+
+    // Parses text[start, end) as a list of statements with spans relative
+    // to start, returns false and keeps the message if it doesn't parse
+    bool parse_region(size_t start, size_t end, vector<Node*>& stmts, vector<StmtSpan>& out);
+
+    // Applies edit to the statements of owner, a prgm or block whose
+    // statement offsets are relative to base and whose contents span
+    // [lo, hi), all in coordinates from before the edit. Returns false if
+    // the edited statements don't parse on their own.
+    bool reparse_list(Node* owner, SpanList list, size_t base, size_t lo, size_t hi, const TextEdit& edit);
+};
@@ -0,0 +1,689 @@
+#include "ir.h"
+#include "fold.h"
+#include <chrono>
+#include <format>
+#include <iostream>
+
+using i64 = int64_t;
+using std::cout;
+using std::endl;
+using nt = NodeType;
+
+void ir_error(string msg, int code) {
+    cout << msg << endl;
+    exit(code);
+}
+
+IrFunc IrBuilder::build() {
+    if(tree_depth(ast) > max_ir_depth) {
+        ir_error(std::format("Programs nested more than {} deep cannot be lowered to IR", max_ir_depth), 15);
+    }
+    cur_block = new_block();
+    ValueId undef = emit(IrOp::undef);
+    defs.assign(ast->frame_size, undef);
+    lower_stmt(ast);
+    func.blocks[cur_block].term = { .kind = TermKind::ret };
+    prune_checks();
+    return func;
+}
+
+void IrBuilder::lower_stmt(Node* cur) {
+    nt type = cur->type;
+    if(type == nt::prgm || type == nt::block) {
+        for(Node* stmt : cur->stmts) {
+            lower_stmt(stmt);
+        }
+    }
+    else if(type == nt::stmt_while) {
+        lower_while(cur);
+    }
+    else if(type == nt::stmt_decl) {
+        defs[cur->slot] = emit(IrOp::undef);
+    }
+    else if(type == nt::stmt_assn) {
+        ValueId value = lower_expr(cur->expr);
+        if(cur->expr->type == nt::lit_id) {
+            value = emit(IrOp::copy, value);
+        }
+        defs[cur->slot] = value;
+    }
+    else if(type == nt::stmt_return) {
+        emit(IrOp::print, lower_expr(cur->expr));
+    }
+}
+
+void IrBuilder::lower_while(Node* cur) {
+    vector<bool> assigned(defs.size());
+    collect_assigned(cur->body, assigned);
+
+    BlockId preheader = cur_block;
+    BlockId header = new_block();
+    jump(preheader, header);
+
+    cur_block = header;
+    vector<std::pair<int32_t, ValueId>> phis;
+    for(size_t slot = 0; slot < assigned.size(); ++slot) {
+        if(assigned[slot]) {
+            ValueId phi = emit(IrOp::phi);
+            func.insts[phi].phi_args.push_back(defs[slot]);
+            phis.push_back({ slot, phi });
+            defs[slot] = phi;
+        }
+    }
+    ValueId cond = lower_expr(cur->expr);
+    BlockId cond_block = cur_block;
+
+    BlockId body = new_block();
+    func.blocks[body].preds.push_back(cond_block);
+    cur_block = body;
+    lower_stmt(cur->body);
+    BlockId latch = cur_block;
+    jump(latch, header);
+    for(auto [slot, phi] : phis) {
+        func.insts[phi].phi_args.push_back(defs[slot]);
+        defs[slot] = phi;
+    }
+
+    BlockId exit = new_block();
+    func.blocks[exit].preds.push_back(cond_block);
+    func.blocks[cond_block].term = {
+        .kind = TermKind::br,
+        .cond = cond,
+        .then_block = body,
+        .else_block = exit,
+    };
+    func.loops.push_back({ preheader, header, exit });
+    cur_block = exit;
+}
+
+ValueId IrBuilder::lower_expr(Node* cur) {
+    nt type = cur->type;
+    if(type == nt::lit_int) {
+        ValueId value = emit(IrOp::constant);
+        func.insts[value].imm = cur->ival;
+        return value;
+    }
+    if(type == nt::lit_id) {
+        ValueId value = defs[cur->slot];
+        ValueId check = emit(IrOp::check, value);
+        func.insts[check].imm = cur->sym;
+        return value;
+    }
+    if(type == nt::paren_group || type == nt::unary_plus) {
+        return lower_expr(cur->expr);
+    }
+    if(type == nt::unary_minus) {
+        return emit(IrOp::neg, lower_expr(cur->expr));
+    }
+    ValueId left = lower_expr(cur->left);
+    ValueId right = lower_expr(cur->right);
+    switch(type) {
+        case nt::biop_plus:
+            return emit(IrOp::add, left, right);
+        case nt::biop_minus:
+            return emit(IrOp::sub, left, right);
+        case nt::biop_mul:
+            return emit(IrOp::mul, left, right);
+        case nt::biop_div:
+            return emit(IrOp::div, left, right);
+    }
+    cout << format("Cannot lower node type {} to IR", to_string::node_type(type)) << endl;
+    exit(15);
+}
+
+void IrBuilder::collect_assigned(Node* cur, vector<bool>& assigned) {
+    nt type = cur->type;
+    if(type == nt::block) {
+        for(Node* stmt : cur->stmts) {
+            collect_assigned(stmt, assigned);
+        }
+    }
+    else if(type == nt::stmt_while) {
+        collect_assigned(cur->body, assigned);
+    }
+    else if(type == nt::stmt_decl || type == nt::stmt_assn) {
+        assigned[cur->slot] = true;
+    }
+}
+
+void IrBuilder::prune_checks() {
+    vector<bool> maybe_undef(func.insts.size());
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(size_t id = 0; id < func.insts.size(); ++id) {
+            const IrInst& inst = func.insts[id];
+            bool value = maybe_undef[id];
+            if(inst.op == IrOp::undef) {
+                value = true;
+            }
+            else if(inst.op == IrOp::copy) {
+                value = maybe_undef[inst.a];
+            }
+            else if(inst.op == IrOp::phi) {
+                for(ValueId arg : inst.phi_args) {
+                    value = value || maybe_undef[arg];
+                }
+            }
+            if(value != maybe_undef[id]) {
+                maybe_undef[id] = value;
+                changed = true;
+            }
+        }
+    }
+    for(IrBlock& block : func.blocks) {
+        std::erase_if(block.insts, [&](ValueId id) {
+            const IrInst& inst = func.insts[id];
+            return inst.op == IrOp::check && !maybe_undef[inst.a];
+        });
+    }
+}
+
+BlockId IrBuilder::new_block() {
+    func.blocks.push_back({});
+    return func.blocks.size() - 1;
+}
+
+void IrBuilder::jump(BlockId from, BlockId to) {
+    func.blocks[from].term = { .kind = TermKind::jmp, .then_block = to };
+    func.blocks[to].preds.push_back(from);
+}
+
+ValueId IrBuilder::emit(IrOp op, ValueId a, ValueId b) {
+    ValueId id = func.insts.size();
+    func.insts.push_back({ .op = op, .a = a, .b = b, .block = cur_block });
+    IrBlock& block = func.blocks[cur_block];
+    if(op == IrOp::phi) {
+        size_t phis = 0;
+        while(phis < block.insts.size() && func.insts[block.insts[phis]].op == IrOp::phi) {
+            ++phis;
+        }
+        block.insts.insert(block.insts.begin() + phis, id);
+    }
+    else {
+        block.insts.push_back(id);
+    }
+    return id;
+}
+
+// Helpers shared by the passes
+namespace ir {
+    bool is_pure(const IrInst& inst) {
+        switch(inst.op) {
+            case IrOp::constant:
+            case IrOp::undef:
+            case IrOp::copy:
+            case IrOp::add:
+            case IrOp::sub:
+            case IrOp::mul:
+            case IrOp::neg:
+            case IrOp::phi:
+                return true;
+        }
+        return false;
+    }
+
+    // A division can only be dropped or moved if it can never trap
+    bool is_safe_div(const IrFunc& func, const IrInst& inst) {
+        const IrInst& divisor = func.insts[inst.b];
+        return divisor.op == IrOp::constant && divisor.imm != 0 && divisor.imm != -1;
+    }
+
+    bool can_remove(const IrFunc& func, const IrInst& inst) {
+        return is_pure(inst) || (inst.op == IrOp::div && is_safe_div(func, inst));
+    }
+
+    ValueId resolve(const vector<ValueId>& replacement, ValueId id) {
+        while(id >= 0 && replacement[id] != id) {
+            id = replacement[id];
+        }
+        return id;
+    }
+
+    // Points every use at its replacement and drops replaced instructions
+    void apply_replacements(IrFunc& func, const vector<ValueId>& replacement) {
+        for(IrBlock& block : func.blocks) {
+            std::erase_if(block.insts, [&](ValueId id) {
+                return replacement[id] != id;
+            });
+            for(ValueId id : block.insts) {
+                IrInst& inst = func.insts[id];
+                inst.a = resolve(replacement, inst.a);
+                inst.b = resolve(replacement, inst.b);
+                for(ValueId& arg : inst.phi_args) {
+                    arg = resolve(replacement, arg);
+                }
+            }
+            block.term.cond = resolve(replacement, block.term.cond);
+        }
+    }
+
+    vector<ValueId> identity(const IrFunc& func) {
+        vector<ValueId> replacement(func.insts.size());
+        for(size_t id = 0; id < replacement.size(); ++id) {
+            replacement[id] = id;
+        }
+        return replacement;
+    }
+
+    // Immediate dominators. Blocks are created in an order where every
+    // block's dominators come before it, so one pass in id order with the
+    // classic intersect walk settles everything but back edges, which
+    // never change a header's dominator.
+    vector<BlockId> immediate_dominators(const IrFunc& func) {
+        vector<BlockId> idom(func.blocks.size(), -1);
+        idom[0] = 0;
+        for(size_t b = 1; b < func.blocks.size(); ++b) {
+            BlockId dom = -1;
+            for(BlockId pred : func.blocks[b].preds) {
+                if(pred >= (BlockId)b || idom[pred] < 0) {
+                    continue;
+                }
+                if(dom < 0) {
+                    dom = pred;
+                    continue;
+                }
+                BlockId x = dom;
+                BlockId y = pred;
+                while(x != y) {
+                    while(x > y) {
+                        x = idom[x];
+                    }
+                    while(y > x) {
+                        y = idom[y];
+                    }
+                }
+                dom = x;
+            }
+            idom[b] = dom;
+        }
+        return idom;
+    }
+}
+
+// Replaces copies with their source and removes phis whose arguments are
+// all the same value, or the phi itself
+void copy_propagation(IrFunc& func) {
+    vector<ValueId> replacement = ir::identity(func);
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(const IrBlock& block : func.blocks) {
+            for(ValueId id : block.insts) {
+                if(replacement[id] != id) {
+                    continue;
+                }
+                const IrInst& inst = func.insts[id];
+                if(inst.op == IrOp::copy) {
+                    replacement[id] = ir::resolve(replacement, inst.a);
+                    changed = true;
+                }
+                else if(inst.op == IrOp::phi) {
+                    ValueId same = -1;
+                    bool trivial = true;
+                    for(ValueId arg : inst.phi_args) {
+                        arg = ir::resolve(replacement, arg);
+                        if(arg == id || arg == same) {
+                            continue;
+                        }
+                        if(same >= 0) {
+                            trivial = false;
+                            break;
+                        }
+                        same = arg;
+                    }
+                    if(trivial && same >= 0) {
+                        replacement[id] = same;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+    ir::apply_replacements(func, replacement);
+}
+
+// Dominator based common subexpression elimination. Walks the dominator
+// tree keeping every expression computed by a dominating block, so a
+// recomputation anywhere below it reuses the earlier value. Repeated
+// checks of the same value are dropped the same way.
+class Cse {
+    struct Key {
+        IrOp op;
+        ValueId a;
+        ValueId b;
+        i64 imm;
+        bool operator==(const Key&) const = default;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            size_t h = (size_t)key.op;
+            h = h * 31 + key.a;
+            h = h * 31 + key.b;
+            h = h * 31 + key.imm;
+            return h;
+        }
+    };
+
+    IrFunc& func;
+    vector<ValueId> replacement;
+    vector<vector<BlockId>> children;
+    std::unordered_map<Key, ValueId, KeyHash> available;
+
+public:
+    Cse(IrFunc& func): func(func), replacement(ir::identity(func)) {}
+
+    void run() {
+        vector<BlockId> idom = ir::immediate_dominators(func);
+        children.resize(func.blocks.size());
+        for(size_t b = 1; b < func.blocks.size(); ++b) {
+            if(idom[b] >= 0) {
+                children[idom[b]].push_back(b);
+            }
+        }
+        visit(0);
+        ir::apply_replacements(func, replacement);
+    }
+
+private:
+    void visit(BlockId block) {
+        vector<Key> added;
+        for(ValueId id : func.blocks[block].insts) {
+            IrInst& inst = func.insts[id];
+            if(inst.op == IrOp::phi || inst.op == IrOp::print || inst.op == IrOp::undef) {
+                continue;
+            }
+            Key key = {
+                inst.op,
+                ir::resolve(replacement, inst.a),
+                ir::resolve(replacement, inst.b),
+                inst.imm,
+            };
+            if((key.op == IrOp::add || key.op == IrOp::mul) && key.a > key.b) {
+                std::swap(key.a, key.b);
+            }
+            auto found = available.find(key);
+            if(found != available.end()) {
+                replacement[id] = inst.op == IrOp::check ? -1 : found->second;
+                continue;
+            }
+            available[key] = id;
+            added.push_back(key);
+        }
+        for(BlockId child : children[block]) {
+            visit(child);
+        }
+        for(const Key& key : added) {
+            available.erase(key);
+        }
+    }
+};
+
+void common_subexpression_elimination(IrFunc& func) {
+    Cse(func).run();
+}
+
+// Moves instructions whose operands are all defined outside a loop into
+// its preheader. Inner loops are handled first, so an invariant can climb
+// out of a whole nest. Divisions only move when they can't trap, since
+// the loop body might never have run.
+void loop_invariant_code_motion(IrFunc& func) {
+    for(const IrLoop& loop : func.loops) {
+        auto in_loop = [&](ValueId id) {
+            BlockId block = func.insts[id].block;
+            return block >= loop.first_block && block < loop.end_block;
+        };
+        IrBlock& preheader = func.blocks[loop.preheader];
+        bool changed = true;
+        while(changed) {
+            changed = false;
+            for(BlockId b = loop.first_block; b < loop.end_block; ++b) {
+                IrBlock& block = func.blocks[b];
+                std::erase_if(block.insts, [&](ValueId id) {
+                    IrInst& inst = func.insts[id];
+                    bool movable = inst.op != IrOp::phi
+                        && inst.op != IrOp::undef
+                        && ir::can_remove(func, inst);
+                    if(!movable
+                        || (inst.a >= 0 && in_loop(inst.a))
+                        || (inst.b >= 0 && in_loop(inst.b))) {
+                        return false;
+                    }
+                    inst.block = loop.preheader;
+                    preheader.insts.push_back(id);
+                    changed = true;
+                    return true;
+                });
+            }
+        }
+    }
+}
+
+// Removes instructions whose values are never used, starting from what
+// has to stay: prints, checks, divisions that might trap and branches
+void dead_code_elimination(IrFunc& func) {
+    vector<bool> live(func.insts.size());
+    vector<ValueId> work;
+    auto mark = [&](ValueId id) {
+        if(id >= 0 && !live[id]) {
+            live[id] = true;
+            work.push_back(id);
+        }
+    };
+    for(const IrBlock& block : func.blocks) {
+        for(ValueId id : block.insts) {
+            if(!ir::can_remove(func, func.insts[id])) {
+                mark(id);
+            }
+        }
+        mark(block.term.cond);
+    }
+    while(!work.empty()) {
+        const IrInst& inst = func.insts[work.back()];
+        work.pop_back();
+        mark(inst.a);
+        mark(inst.b);
+        for(ValueId arg : inst.phi_args) {
+            mark(arg);
+        }
+    }
+    for(IrBlock& block : func.blocks) {
+        std::erase_if(block.insts, [&](ValueId id) {
+            return !live[id];
+        });
+    }
+}
+
+bool PassManager::set_enabled(const string& name, bool enabled) {
+    bool found = false;
+    for(IrPass& pass : passes) {
+        if(pass.name == name) {
+            pass.enabled = enabled;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void PassManager::run(IrFunc& func) {
+    report = std::format("{:<10} {:>10} {:>8}\n", "pass", "time (us)", "insts");
+    report += std::format("{:<10} {:>10} {:>8}\n", "lowering", "", func.num_live_insts());
+    for(const IrPass& pass : passes) {
+        if(!pass.enabled) {
+            report += std::format("{:<10} {:>10} {:>8}\n", pass.name, "off", "");
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        pass.run(func);
+        auto end = std::chrono::steady_clock::now();
+        double us = std::chrono::duration<double, std::micro>(end - start).count();
+        report += std::format("{:<10} {:>10.1f} {:>8}\n", pass.name, us, func.num_live_insts());
+    }
+}
+
+void IrEval::eval() {
+    BlockId block = 0;
+    BlockId pred = -1;
+    while(true) {
+        const IrBlock& cur = func.blocks[block];
+        // Phis read their arguments before any of them is written
+        phi_moves.clear();
+        size_t first = 0;
+        for(; first < cur.insts.size() && func.insts[cur.insts[first]].op == IrOp::phi; ++first) {
+            ValueId id = cur.insts[first];
+            const IrInst& phi = func.insts[id];
+            for(size_t i = 0; i < cur.preds.size(); ++i) {
+                if(cur.preds[i] == pred) {
+                    phi_moves.push_back({ id, phi.phi_args[i] });
+                }
+            }
+        }
+        moved_values.clear();
+        moved_defined.clear();
+        for(auto [dst, src] : phi_moves) {
+            moved_values.push_back(values[src]);
+            moved_defined.push_back(defined[src]);
+        }
+        for(size_t i = 0; i < phi_moves.size(); ++i) {
+            values[phi_moves[i].first] = moved_values[i];
+            defined[phi_moves[i].first] = moved_defined[i];
+        }
+        for(size_t i = first; i < cur.insts.size(); ++i) {
+            exec(cur.insts[i]);
+        }
+        pred = block;
+        if(cur.term.kind == TermKind::ret) {
+            return;
+        }
+        if(cur.term.kind == TermKind::jmp || values[cur.term.cond] != 0) {
+            block = cur.term.then_block;
+        }
+        else {
+            block = cur.term.else_block;
+        }
+    }
+}
+
+void IrEval::exec(ValueId id) {
+    const IrInst& inst = func.insts[id];
+    i64& dst = values[id];
+    defined[id] = true;
+    switch(inst.op) {
+        case IrOp::constant:
+            dst = inst.imm;
+            break;
+        case IrOp::undef:
+            defined[id] = false;
+            break;
+        case IrOp::copy:
+            dst = values[inst.a];
+            defined[id] = defined[inst.a];
+            break;
+        case IrOp::add:
+            dst = values[inst.a] + values[inst.b];
+            break;
+        case IrOp::sub:
+            dst = values[inst.a] - values[inst.b];
+            break;
+        case IrOp::mul:
+            dst = values[inst.a] * values[inst.b];
+            break;
+        case IrOp::div:
+            dst = values[inst.a] / values[inst.b];
+            break;
+        case IrOp::neg:
+            dst = -values[inst.a];
+            break;
+        case IrOp::check:
+            if(!defined[inst.a]) {
+                ir_error(std::format("symbol '{}' has not been initialized", names.name(inst.imm)), 9);
+            }
+            break;
+        case IrOp::print:
+            cout << values[inst.a] << endl;
+            break;
+        case IrOp::phi:
+            break;
+    }
+}
+
+namespace to_string {
+    string ir_op(IrOp op) {
+        switch(op) {
+            case IrOp::constant:
+                return "const";
+            case IrOp::undef:
+                return "undef";
+            case IrOp::copy:
+                return "copy";
+            case IrOp::add:
+                return "add";
+            case IrOp::sub:
+                return "sub";
+            case IrOp::mul:
+                return "mul";
+            case IrOp::div:
+                return "div";
+            case IrOp::neg:
+                return "neg";
+            case IrOp::phi:
+                return "phi";
+            case IrOp::check:
+                return "check";
+            case IrOp::print:
+                return "print";
+        }
+        return "UNRECOG IR OP";
+    }
+
+    string ir_func(const IrFunc& func, const Interner& names) {
+        string s;
+        for(size_t b = 0; b < func.blocks.size(); ++b) {
+            const IrBlock& block = func.blocks[b];
+            s += std::format("b{}:", b);
+            if(!block.preds.empty()) {
+                s += " ; preds";
+                for(BlockId pred : block.preds) {
+                    s += std::format(" b{}", pred);
+                }
+            }
+            s += "\n";
+            for(ValueId id : block.insts) {
+                const IrInst& inst = func.insts[id];
+                if(inst.op == IrOp::check || inst.op == IrOp::print) {
+                    s += "    " + to_string::ir_op(inst.op);
+                }
+                else {
+                    s += std::format("    v{} = {}", id, to_string::ir_op(inst.op));
+                }
+                if(inst.op == IrOp::constant) {
+                    s += std::format(" {}", inst.imm);
+                }
+                for(size_t i = 0; i < inst.phi_args.size(); ++i) {
+                    s += std::format("{} [v{}, b{}]", i == 0 ? "" : ",", inst.phi_args[i], block.preds[i]);
+                }
+                if(inst.a >= 0) {
+                    s += std::format(" v{}", inst.a);
+                }
+                if(inst.b >= 0) {
+                    s += std::format(", v{}", inst.b);
+                }
+                if(inst.op == IrOp::check) {
+                    s += std::format(" ; {}", names.name(inst.imm));
+                }
+                s += "\n";
+            }
+            const IrTerm& term = block.term;
+            if(term.kind == TermKind::jmp) {
+                s += std::format("    jmp b{}\n", term.then_block);
+            }
+            else if(term.kind == TermKind::br) {
+                s += std::format("    br v{}, b{}, b{}\n", term.cond, term.then_block, term.else_block);
+            }
+            else {
+                s += "    ret\n";
+            }
+        }
+        return s;
+    }
+}
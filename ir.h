@@ -0,0 +1,172 @@
+#pragma once
+#include "gavcc.h"
+
+// SSA form mid-level IR. A function is a control flow graph of basic
+// blocks, each holding a list of instruction ids and ending in one
+// terminator. Every instruction defines the value with its own id, and
+// while loop headers merge values from the preheader and the latch with
+// phi instructions.
+enum class IrOp : uint8_t {
+    constant, // imm
+    undef,    // value of a declared but unassigned variable
+    copy,     // a
+    add,      // a + b
+    sub,      // a - b
+    mul,      // a * b
+    div,      // a / b
+    neg,      // -a
+    phi,      // phi_args[i] when entered from preds[i]
+    check,    // stop with an error if a is undef, imm is the SymId
+    print,    // print a
+};
+
+using ValueId = int32_t;
+using BlockId = int32_t;
+
+struct IrInst {
+    IrOp op;
+    ValueId a = -1;
+    ValueId b = -1;
+    int64_t imm = 0;
+    vector<ValueId> phi_args;
+    BlockId block = -1;
+};
+
+enum class TermKind : uint8_t {
+    jmp,
+    br,
+    ret,
+};
+
+struct IrTerm {
+    TermKind kind = TermKind::ret;
+    ValueId cond = -1;
+    // Target of jmp, or the nonzero target of br
+    BlockId then_block = -1;
+    BlockId else_block = -1;
+};
+
+struct IrBlock {
+    // Phis always come first
+    vector<ValueId> insts;
+    IrTerm term;
+    vector<BlockId> preds;
+};
+
+// Blocks first_block up to end_block belong to the loop, the header is
+// first_block
+struct IrLoop {
+    BlockId preheader;
+    BlockId first_block;
+    BlockId end_block;
+};
+
+struct IrFunc {
+    vector<IrInst> insts;
+    vector<IrBlock> blocks;
+    // Innermost loops come first
+    vector<IrLoop> loops;
+
+    size_t num_live_insts() const {
+        size_t count = 0;
+        for(const IrBlock& block : blocks) {
+            count += block.insts.size();
+        }
+        return count;
+    }
+};
+
+namespace to_string {
+    string ir_op(IrOp op);
+    string ir_func(const IrFunc& func, const Interner& names);
+}
+
+constexpr size_t max_ir_depth = 10000;
+
+// Lowers a checked AST to SSA. Variables are tracked per SemAnal frame
+// slot: reads take the slot's current definition and assignments just
+// rebind it, so no loads or stores survive into the IR. Lowering
+// recurses over the tree and fails to compile past max_ir_depth.
+class IrBuilder {
+    Node* ast;
+    IrFunc func;
+    BlockId cur_block = 0;
+    vector<ValueId> defs;
+
+public:
+    IrBuilder(Node* ast): ast(ast) {}
+
+    IrFunc build();
+
+private:
+    void lower_stmt(Node* cur);
+    void lower_while(Node* cur);
+    ValueId lower_expr(Node* cur);
+    void collect_assigned(Node* cur, vector<bool>& assigned);
+
+    // Only reads that may see an undef need their check. A value may be
+    // undef if it is one, or is a phi or copy of one.
+    void prune_checks();
+    BlockId new_block();
+    void jump(BlockId from, BlockId to);
+    ValueId emit(IrOp op, ValueId a = -1, ValueId b = -1);
+};
+
+// The optimization passes, in the order PassManager runs them
+void copy_propagation(IrFunc& func);
+void common_subexpression_elimination(IrFunc& func);
+void loop_invariant_code_motion(IrFunc& func);
+void dead_code_elimination(IrFunc& func);
+
+struct IrPass {
+    string name;
+    void (*run)(IrFunc&);
+    bool enabled = true;
+};
+
+// Runs the enabled passes in order and records how long each took and
+// how many instructions it left behind. cse runs again after licm: an
+// invariant hoisted out of two loops in a row lands in two preheaders,
+// and the first one dominates the second. Disabling a pass by name
+// disables both of its runs.
+class PassManager {
+    vector<IrPass> passes = {
+        { "copyprop", copy_propagation },
+        { "cse", common_subexpression_elimination },
+        { "licm", loop_invariant_code_motion },
+        { "cse", common_subexpression_elimination },
+        { "dce", dead_code_elimination },
+    };
+    string report;
+
+public:
+    // Returns false if there is no pass with that name
+    bool set_enabled(const string& name, bool enabled);
+    void run(IrFunc& func);
+
+    const string& timing_report() {
+        return report;
+    }
+};
+
+// Interprets an IrFunc. Values are kept per instruction id, with a flag
+// marking the ones that hold undef so checks can report them.
+class IrEval {
+    const IrFunc& func;
+    const Interner& names;
+    vector<int64_t> values;
+    vector<uint8_t> defined;
+    // Scratch space for the parallel phi assignment on block entry
+    vector<std::pair<ValueId, ValueId>> phi_moves;
+    vector<int64_t> moved_values;
+    vector<uint8_t> moved_defined;
+
+public:
+    IrEval(const IrFunc& func, const Interner& names):
+        func(func), names(names), values(func.insts.size()), defined(func.insts.size()) {}
+
+    void eval();
+
+private:
+    void exec(ValueId id);
+};
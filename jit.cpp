@@ -0,0 +1,343 @@
+#include "jit.h"
+#include "fold.h"
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using i64 = int64_t;
+using nt = NodeType;
+
+// x86-64 register numbers as used in ModRM and REX encodings
+enum Reg : uint8_t {
+    rax = 0, rcx = 1, rdx = 2, rbx = 3, rsp = 4, rbp = 5, rsi = 6, rdi = 7,
+    r8 = 8, r9 = 9, r10 = 10, r11 = 11,
+};
+
+// Emits machine code for one loop. Follows the same scheme as AsmGen:
+// temporaries come from a pool of caller saved registers and the left
+// operand is pushed when the pool runs dry. Values are addressed off
+// %rdi and initialized flags off %rsi, the two arguments of JitLoop.
+class JitCompiler {
+    static constexpr size_t max_jit_depth = 10000;
+    static constexpr Reg values = rdi;
+    static constexpr Reg initialized = rsi;
+    static constexpr Reg pool[] = { rcx, r8, r9, r10, r11 };
+    vector<uint8_t> code;
+    vector<Reg> free_regs;
+    // Uninitialized reads: offset of the jump's rel32 and the node to report
+    vector<std::pair<size_t, Node*>> bails;
+
+public:
+    JitCompiler() {
+        for(int i = std::size(pool) - 1; i >= 0; --i) {
+            free_regs.push_back(pool[i]);
+        }
+    }
+
+    // Returns false if the loop uses something the JIT doesn't handle, or
+    // is nested too deep for compiling it recursively
+    bool compile(Node* loop, vector<uint8_t>& out) {
+        if(tree_depth(loop) > max_jit_depth || !supported(loop)) {
+            return false;
+        }
+        // push %rbp; mov %rsp, %rbp so bails can drop any pushed temporaries
+        byte(0x55);
+        rex_rm(rsp, rbp);
+        byte(0x89);
+        modrm_reg(rsp, rbp);
+        stmt(loop);
+        // xor %eax, %eax
+        byte(0x31);
+        byte(0xC0);
+        epilogue();
+        for(auto [fixup, node] : bails) {
+            patch_rel32(fixup, code.size());
+            mov_imm(rax, reinterpret_cast<i64>(node));
+            epilogue();
+        }
+        out = std::move(code);
+        return true;
+    }
+
+private:
+    bool supported(Node* cur) {
+        switch(cur->type) {
+            case nt::block:
+                for(Node* stmt : cur->stmts) {
+                    if(!supported(stmt)) {
+                        return false;
+                    }
+                }
+                return true;
+            case nt::stmt_while:
+                return supported(cur->expr) && supported(cur->body);
+            case nt::stmt_decl:
+            case nt::lit_int:
+            case nt::lit_id:
+                return true;
+            case nt::stmt_assn:
+            case nt::paren_group:
+            case nt::unary_plus:
+            case nt::unary_minus:
+                return supported(cur->expr);
+            case nt::biop_plus:
+            case nt::biop_minus:
+            case nt::biop_mul:
+            case nt::biop_div:
+                return supported(cur->left) && supported(cur->right);
+        }
+        // Printing from stmt_return is left to the interpreter
+        return false;
+    }
+
+    void stmt(Node* cur) {
+        nt type = cur->type;
+        if(type == nt::block) {
+            for(Node* s : cur->stmts) {
+                stmt(s);
+            }
+        }
+        else if(type == nt::stmt_while) {
+            size_t enter = jmp();
+            size_t top = code.size();
+            stmt(cur->body);
+            patch_rel32(enter, code.size());
+            Reg cond = expr(cur->expr);
+            // test cond, cond; jnz top
+            rex_rm(cond, cond);
+            byte(0x85);
+            modrm_reg(cond, cond);
+            patch_rel32(jcc(0x85), top);
+            free_reg(cond);
+        }
+        else if(type == nt::stmt_decl) {
+            set_initialized(cur->slot, 0);
+        }
+        else if(type == nt::stmt_assn) {
+            Reg value = expr(cur->expr);
+            // mov value, slot*8(%rdi)
+            rex_rm(value, values);
+            byte(0x89);
+            modrm_disp32(value, values, cur->slot * 8);
+            set_initialized(cur->slot, 1);
+            free_reg(value);
+        }
+    }
+
+    Reg expr(Node* cur) {
+        nt type = cur->type;
+        if(type == nt::lit_int) {
+            Reg dst = alloc_reg();
+            mov_imm(dst, cur->ival);
+            return dst;
+        }
+        if(type == nt::lit_id) {
+            // cmpb $0, slot(%rsi); je bail
+            byte(0x80);
+            modrm_disp32(7, initialized, cur->slot);
+            byte(0);
+            bails.push_back({ jcc(0x84), cur });
+            Reg dst = alloc_reg();
+            // mov slot*8(%rdi), dst
+            rex_rm(dst, values);
+            byte(0x8B);
+            modrm_disp32(dst, values, cur->slot * 8);
+            return dst;
+        }
+        if(type == nt::paren_group || type == nt::unary_plus) {
+            return expr(cur->expr);
+        }
+        if(type == nt::unary_minus) {
+            Reg dst = expr(cur->expr);
+            // neg dst
+            rex_rm(0, dst);
+            byte(0xF7);
+            modrm_reg(3, dst);
+            return dst;
+        }
+
+        Reg left = expr(cur->left);
+        if(!free_regs.empty()) {
+            Reg right = expr(cur->right);
+            biop(type, left, right);
+            free_reg(right);
+            return left;
+        }
+        push(left);
+        free_reg(left);
+        Reg right = expr(cur->right);
+        pop(rax);
+        biop(type, rax, right);
+        mov_reg(right, rax);
+        return right;
+    }
+
+    // dst = dst op src
+    void biop(nt type, Reg dst, Reg src) {
+        if(type == nt::biop_plus) {
+            rex_rm(src, dst);
+            byte(0x01);
+            modrm_reg(src, dst);
+        }
+        else if(type == nt::biop_minus) {
+            rex_rm(src, dst);
+            byte(0x29);
+            modrm_reg(src, dst);
+        }
+        else if(type == nt::biop_mul) {
+            rex_rm(dst, src);
+            byte(0x0F);
+            byte(0xAF);
+            modrm_reg(dst, src);
+        }
+        else if(type == nt::biop_div) {
+            mov_reg(rax, dst);
+            // cqo; idiv src
+            byte(0x48);
+            byte(0x99);
+            rex_rm(0, src);
+            byte(0xF7);
+            modrm_reg(7, src);
+            mov_reg(dst, rax);
+        }
+    }
+
+    void set_initialized(int32_t slot, uint8_t value) {
+        // movb $value, slot(%rsi)
+        byte(0xC6);
+        modrm_disp32(0, initialized, slot);
+        byte(value);
+    }
+
+    void mov_imm(Reg dst, i64 imm) {
+        // movabs $imm, dst
+        rex_rm(0, dst);
+        byte(0xB8 + (dst & 7));
+        bytes(&imm, 8);
+    }
+
+    void mov_reg(Reg dst, Reg src) {
+        if(dst == src) {
+            return;
+        }
+        rex_rm(src, dst);
+        byte(0x89);
+        modrm_reg(src, dst);
+    }
+
+    void push(Reg reg) {
+        if(reg >= 8) {
+            byte(0x41);
+        }
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(Reg reg) {
+        if(reg >= 8) {
+            byte(0x41);
+        }
+        byte(0x58 + (reg & 7));
+    }
+
+    void epilogue() {
+        // mov %rbp, %rsp; pop %rbp; ret
+        rex_rm(rbp, rsp);
+        byte(0x89);
+        modrm_reg(rbp, rsp);
+        byte(0x5D);
+        byte(0xC3);
+    }
+
+    // Both return the offset of the rel32 to patch
+    size_t jmp() {
+        byte(0xE9);
+        size_t fixup = code.size();
+        bytes("\0\0\0\0", 4);
+        return fixup;
+    }
+
+    size_t jcc(uint8_t cond) {
+        byte(0x0F);
+        byte(cond);
+        size_t fixup = code.size();
+        bytes("\0\0\0\0", 4);
+        return fixup;
+    }
+
+    void patch_rel32(size_t fixup, size_t target) {
+        int32_t rel = target - (fixup + 4);
+        memcpy(&code[fixup], &rel, 4);
+    }
+
+    // REX.W prefix with the high bits of the reg and rm fields
+    void rex_rm(uint8_t reg, uint8_t rm) {
+        byte(0x48 | ((reg >> 3) << 2) | (rm >> 3));
+    }
+
+    void modrm_reg(uint8_t reg, uint8_t rm) {
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // disp32(base), base is never %rsp or %r12 so no SIB byte is needed
+    void modrm_disp32(uint8_t reg, uint8_t base, int32_t disp) {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        bytes(&disp, 4);
+    }
+
+    void byte(uint8_t b) {
+        code.push_back(b);
+    }
+
+    void bytes(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        code.insert(code.end(), p, p + size);
+    }
+
+    Reg alloc_reg() {
+        Reg reg = free_regs.back();
+        free_regs.pop_back();
+        return reg;
+    }
+
+    void free_reg(Reg reg) {
+        free_regs.push_back(reg);
+    }
+};
+
+Jit::~Jit() {
+    for(auto& [loop, compiled] : loops) {
+        if(compiled.mem) {
+            munmap(compiled.mem, compiled.size);
+        }
+    }
+}
+
+JitLoop Jit::get(Node* loop) {
+    auto found = loops.find(loop);
+    if(found != loops.end()) {
+        return found->second.fn;
+    }
+    Compiled compiled = compile(loop);
+    loops[loop] = compiled;
+    return compiled.fn;
+}
+
+Jit::Compiled Jit::compile(Node* loop) {
+    vector<uint8_t> code;
+    JitCompiler compiler;
+    if(!compiler.compile(loop, code)) {
+        return {};
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (code.size() + page - 1) / page * page;
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) {
+        return {};
+    }
+    memcpy(mem, code.data(), code.size());
+    if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return {};
+    }
+    return { reinterpret_cast<JitLoop>(mem), mem, size };
+}
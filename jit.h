@@ -0,0 +1,40 @@
+#pragma once
+#include "gavcc.h"
+#include <unordered_map>
+
+// A compiled stmt_while. Runs the loop to completion against the Frame's
+// arrays and returns nullptr, or returns the lit_id that read an
+// uninitialized slot so Eval can report it.
+using JitLoop = Node* (*)(int64_t* values, uint8_t* initialized);
+
+// Tiering for Eval: once a single execution of a while loop has run
+// threshold iterations in the interpreter, the loop is compiled and the
+// rest of it runs as machine code. Loops the compiler can't handle are
+// remembered and stay interpreted.
+class Jit {
+    struct Compiled {
+        JitLoop fn;
+        void* mem;
+        size_t size;
+    };
+    std::unordered_map<Node*, Compiled> loops;
+    int64_t threshold;
+
+public:
+    Jit(int64_t threshold): threshold(threshold) {}
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    ~Jit();
+
+    bool is_hot(int64_t iterations) {
+        return iterations >= threshold;
+    }
+
+    // Returns nullptr if the loop can't be compiled
+    JitLoop get(Node* loop);
+
+private:
+    Compiled compile(Node* loop);
+};
@@ -0,0 +1,33 @@
+#include "output.h"
+#include <cerrno>
+#include <unistd.h>
+
+void OutputSink::flush() {
+    send(buffer.get(), used);
+    used = 0;
+}
+
+void OutputSink::send(const char* data, size_t size) {
+    flushed += size;
+    if(fd >= 0) {
+        while(size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                failed = true;
+                break;
+            }
+            data += n;
+            size -= n;
+        }
+    }
+    else if(stream) {
+        stream->write(data, size);
+        failed = !*stream;
+    }
+    else if(str) {
+        str->append(data, size);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "gavcc.h"
+#include <charconv>
+#include <cstring>
+
+// Buffered writer for generated code. Text collects in a fixed buffer that
+// is handed on whenever it fills up, to a file descriptor, an ostream or a
+// string, or nowhere at all for timing. Memory stays constant however much
+// is written, unless the destination is a string.
+class OutputSink {
+    static constexpr size_t buffer_size = 64 * 1024;
+    std::unique_ptr<char[]> buffer = std::make_unique<char[]>(buffer_size);
+    size_t used = 0;
+    uint64_t flushed = 0;
+    int fd = -1;
+    std::ostream* stream = nullptr;
+    string* str = nullptr;
+    bool failed = false;
+
+public:
+    // Discards everything
+    OutputSink() = default;
+    explicit OutputSink(int fd): fd(fd) {}
+    explicit OutputSink(std::ostream& stream): stream(&stream) {}
+    // Appends to str
+    explicit OutputSink(string& str): str(&str) {}
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    ~OutputSink() {
+        flush();
+    }
+
+    void write(std::string_view s) {
+        if(s.size() > buffer_size - used) {
+            flush();
+            if(s.size() > buffer_size) {
+                send(s.data(), s.size());
+                return;
+            }
+        }
+        memcpy(buffer.get() + used, s.data(), s.size());
+        used += s.size();
+    }
+
+    void put(char c) {
+        if(used == buffer_size) {
+            flush();
+        }
+        buffer[used++] = c;
+    }
+
+    void write_int(int64_t value) {
+        // Room for the sign and 19 digits
+        if(buffer_size - used < 20) {
+            flush();
+        }
+        used = std::to_chars(buffer.get() + used, buffer.get() + buffer_size, value).ptr - buffer.get();
+    }
+
+    void flush();
+
+    // Bytes written in all, flushed or not
+    uint64_t size() const {
+        return flushed + used;
+    }
+
+    // False once a write to the file descriptor or stream has failed
+    explicit operator bool() const {
+        return !failed;
+    }
+
+private:
+    void send(const char* data, size_t size);
+};
@@ -1,21 +1,18 @@
-#include "gavcc.h"
-#include <iostream>
+#include "parser.h"
+#include <algorithm>
+#include <array>
 
 using nt = NodeType;
 using tt = TokenType;
-using std::cout;
-using std::endl;
 
 [[noreturn]]
 void expected_but_found(string expected, Token found) {
-    cout << "Expected " << expected << ", but found " << to_string::token(found) << endl;
-    exit(2);
+    compile_error("Expected " + expected + ", but found " + to_string::token(found), 2);
 }
 
 [[noreturn]]
 void expected_but_found(tt expected_type, Token found) {
-    cout << "Expected " << to_string::token_type(expected_type) << ", but found " << to_string::token(found) << endl;
-    exit(3);
+    compile_error("Expected " + to_string::token_type(expected_type) + ", but found " + to_string::token(found), 3);
 }
 
 void assert_not_eof(Token token, string msg) {
@@ -30,250 +27,292 @@ void assert_for(tt expected_type, Token token) {
     }
 }
 
-class Parser {
-    const vector<Token> tokens;
-    uint idx = 0;
+// What a token does in an expression. Binding powers grow with how
+// tightly an operator binds, and prefix operators bind tighter than any
+// binary one. Adding an operator only takes an entry here.
+struct OpInfo {
+    // Binding power as a binary operator, 0 if the token isn't one
+    uint8_t infix_bp;
+    bool right_assoc;
+    NodeType infix;
+    // What parse errors call its right operand
+    const char* operand;
+    bool prefix;
+    NodeType prefix_node;
+};
 
-public:
-    Parser(vector<Token> tokens): tokens(tokens) {}
+constexpr uint8_t prefix_bp = 3;
 
-    Node* parse() {
-        Node* prgm_root = new Node;
-        prgm_root->type = nt::prgm;
+constexpr std::array<OpInfo, (size_t)tt::eof + 1> op_table = [] {
+    std::array<OpInfo, (size_t)tt::eof + 1> ops{};
+    ops[(size_t)tt::plus] = { 1, false, nt::biop_plus, "term", true, nt::unary_plus };
+    ops[(size_t)tt::minus] = { 1, false, nt::biop_minus, "term", true, nt::unary_minus };
+    ops[(size_t)tt::star] = { 2, false, nt::biop_mul, "unit" };
+    ops[(size_t)tt::div] = { 2, false, nt::biop_div, "unit" };
+    return ops;
+}();
 
-        while(cur().type != tt::eof) {
-            prgm_root->stmts.push_back(parse_stmt());
-        }
-        assert_for(tt::eof, cur());
+static_assert(std::ranges::all_of(op_table, [](const OpInfo& op) { return op.infix_bp + op.right_assoc < prefix_bp; }),
+    "prefix operators have to bind tighter than binary ones");
+
+Parser::Parser(Scanner& scanner, Arena& arena):
+    scanner(scanner), token(scanner.next_token()), arena(arena) {}
 
-        return prgm_root;
+Node* Parser::parse() {
+    Node* prgm_root = arena.make<Node>();
+    prgm_root->type = nt::prgm;
+
+    vector<Node*> stmts;
+    while(cur().type != tt::eof) {
+        stmts.push_back(parse_stmt());
     }
+    assert_for(tt::eof, cur());
+    prgm_root->stmts = arena.make_array(stmts);
 
-private:
-    Node* parse_stmt() {
-        Node* result;
-        tt type = cur().type;
-        if(type == tt::lbrace) {
-            return parse_block();
-        }
-        else if(type == tt::kw_while) {
-            return parse_while();
-        }
-        else if(type == tt::kw_int) {
-            result = parse_stmt_decl();
-            assert_for(tt::semicolon, cur());
-            next();
-            return result;
-        }
-        else if(type == tt::id) {
-            result =  parse_stmt_assn();
-            assert_for(tt::semicolon, cur());
-            next();
-            return result;
+    return prgm_root;
+}
+
+vector<Node*> Parser::parse_stmts(const char* base, vector<StmtSpan>& out) {
+    spans = &out;
+    span_base = base;
+    vector<Node*> stmts;
+    while(cur().type != tt::eof) {
+        stmts.push_back(parse_stmt());
+    }
+    spans = nullptr;
+    return stmts;
+}
+
+// A completed statement goes to the innermost open statement, which may
+// complete in turn, until a block wants another statement or the
+// statement parse_stmt started is done
+Node* Parser::parse_stmt() {
+    size_t outer = open_stmts.size();
+    while(true) {
+        Node* done = start_stmt();
+        while(open_stmts.size() > outer) {
+            OpenStmt& top = open_stmts.back();
+            if(top.node->type == nt::stmt_while) {
+                if(!done) {
+                    break;
+                }
+                top.node->body = done;
+            }
+            else {
+                if(done) {
+                    top.stmts.push_back(done);
+                }
+                if(cur().type != tt::rbrace) {
+                    break;
+                }
+                next();
+                top.node->stmts = arena.make_array(top.stmts);
+            }
+            done = close_stmt();
         }
-        else if(type == tt::kw_return) {
-            result =  parse_stmt_return();
-            assert_for(tt::semicolon, cur());
-            next();
-            return result;
+        if(open_stmts.size() == outer) {
+            return done;
         }
-        expected_but_found("Stmt", cur());
     }
+}
 
-    Node* parse_block() {
-        assert_for(tt::lbrace, cur());
+Node* Parser::start_stmt() {
+    const char* start = cur().lexeme.data();
+    Node* result;
+    tt type = cur().type;
+    if(type == tt::lbrace) {
         next();
-
-        Node* block_root = new Node;
+        Node* block_root = arena.make<Node>();
         block_root->type = nt::block;
-        while(cur().type != tt::rbrace) {
-            block_root->stmts.push_back(parse_stmt());
-        }
-
-        assert_for(tt::rbrace, cur());
-        next();
+        open_stmts.push_back({ block_root, {}, start });
+        return nullptr;
+    }
+    else if(type == tt::kw_while) {
+        open_stmts.push_back({ parse_while(), {}, start });
+        return nullptr;
+    }
+    else if(type == tt::kw_int) {
+        result = parse_stmt_decl();
+    }
+    else if(type == tt::id) {
+        result = parse_stmt_assn();
+    }
+    else if(type == tt::kw_return) {
+        result = parse_stmt_return();
+    }
+    else {
+        expected_but_found("Stmt", cur());
+    }
+    assert_for(tt::semicolon, cur());
+    next();
+    if(spans) {
+        record_span(result, start, {});
+    }
+    return result;
+}
 
-        return block_root;
+Node* Parser::close_stmt() {
+    OpenStmt top = std::move(open_stmts.back());
+    open_stmts.pop_back();
+    if(spans) {
+        record_span(top.node, top.start, std::move(top.inner));
     }
+    return top.node;
+}
 
-    Node* parse_while() {
-        assert_for(tt::kw_while, cur());
-        next();
-        assert_for(tt::lparen, cur());
-        next();
+// Spans are relative to the innermost open statement, or to the text
+// parse_stmts was given
+void Parser::record_span(Node* node, const char* start, vector<StmtSpan> inner) {
+    const char* base = open_stmts.empty() ? span_base : open_stmts.back().start;
+    vector<StmtSpan>& list = open_stmts.empty() ? *spans : open_stmts.back().inner;
+    list.push_back({ node, (uint32_t)(start - base), (uint32_t)(consumed_end - base), std::move(inner) });
+}
 
-        Node* while_root = new Node;
-        while_root->type = nt::stmt_while;
-        while_root->expr = parse_expr();
+Node* Parser::parse_while() {
+    assert_for(tt::kw_while, cur());
+    next();
+    assert_for(tt::lparen, cur());
+    next();
 
-        assert_for(tt::rparen, cur());
-        next();
+    Node* while_root = arena.make<Node>();
+    while_root->type = nt::stmt_while;
+    while_root->expr = parse_expr();
 
-        while_root->body = parse_stmt();
+    assert_for(tt::rparen, cur());
+    next();
 
-        return while_root;
-    }
+    return while_root;
+}
 
-    Node* parse_stmt_decl() {
-        assert_for(tt::kw_int, cur());
-        next();
+Node* Parser::parse_stmt_decl() {
+    assert_for(tt::kw_int, cur());
+    next();
 
-        Node* decl_root = new Node;
-        decl_root->type = nt::stmt_decl;
-        assert_for(tt::id, cur());
-        decl_root->id = cur().id;
-        next();
-        return decl_root;
-    }
+    Node* decl_root = arena.make<Node>();
+    decl_root->type = nt::stmt_decl;
+    assert_for(tt::id, cur());
+    decl_root->sym = cur().sym;
+    next();
+    return decl_root;
+}
 
-    Node* parse_stmt_assn() {
-        assert_for(tt::id, cur());
-        Node* assn_root = new Node;
-        assn_root->type = nt::stmt_assn;
-        assn_root->id = cur().id;
-        next();
+Node* Parser::parse_stmt_assn() {
+    assert_for(tt::id, cur());
+    Node* assn_root = arena.make<Node>();
+    assn_root->type = nt::stmt_assn;
+    assn_root->sym = cur().sym;
+    next();
 
-        assert_for(tt::equal, cur());
-        next();
+    assert_for(tt::equal, cur());
+    next();
 
-        assn_root->expr = parse_expr();
-        return assn_root;
-    }
-
-    Node* parse_stmt_return() {
-        assert_for(tt::kw_return, cur());
-        next();
+    assn_root->expr = parse_expr();
+    return assn_root;
+}
 
-        Node* return_root = new Node;
-        return_root->type = nt::stmt_return;
-        return_root->expr = parse_expr();
-        return return_root;
-    }
+Node* Parser::parse_stmt_return() {
+    assert_for(tt::kw_return, cur());
+    next();
 
-    Node* parse_expr() {
-        Node* expr_root = parse_term();
+    Node* return_root = arena.make<Node>();
+    return_root->type = nt::stmt_return;
+    return_root->expr = parse_expr();
+    return return_root;
+}
 
-        while(cur().type == tt::plus || cur().type == tt::minus) {
-            Node* biop = new Node;
-            biop->token = cur();
-            if(cur().type == tt::plus) {
-                biop->type = nt::biop_plus;
+// Pratt parsing driven by op_table, with pending in place of the call
+// stack. Every operand is a literal behind any number of prefix operators
+// and open parens. Once it is parsed, an operator after it first closes
+// the pending operators that bind at least as tightly, or strictly more
+// tightly if it is right associative, then waits for its own right
+// operand. For the current table this is the grammar
+//
+//   expr := term (('+' | '-') term)*
+//   term := unit (('*' | '/') unit)*
+//   unit := ('+' | '-') unit | '(' expr ')' | lit
+Node* Parser::parse_expr() {
+    size_t bottom = pending.size();
+    while(true) {
+        while(true) {
+            const OpInfo& op = op_table[(size_t)cur().type];
+            if(op.prefix) {
+                Node* result = arena.make<Node>();
+                result->type = op.prefix_node;
+                pending.push_back({ result, prefix_bp });
+                next();
+            }
+            else if(cur().type == tt::lparen) {
+                next();
+                Node* result = arena.make<Node>();
+                result->type = nt::paren_group;
+                pending.push_back({ result, 0 });
             }
             else {
-                biop->type = nt::biop_minus;
+                break;
             }
-            next();
-
-            assert_not_eof(cur(), "term");
-            Node * right = parse_term();
-
-            biop->left = expr_root;
-            biop->right = right;
-            expr_root = biop;
         }
-
-        return expr_root;
-    }
-
-    Node* parse_term() {
-        Node* term_root = parse_unit();
-        
-        while(cur().type == tt::star || cur().type == tt::div) {
-            Node* biop = new Node;
-            biop->token = cur();
-            if(cur().type == tt::star) {
-                biop->type = nt::biop_mul;
+        Node* operand = parse_lit();
+
+        while(true) {
+            const OpInfo& op = op_table[(size_t)cur().type];
+            // Anything but an operator closes everything down to a paren
+            uint8_t min_bp = op.infix_bp ? op.infix_bp + op.right_assoc : 1;
+            while(pending.size() > bottom && pending.back().bp >= min_bp) {
+                Node* top = pending.back().node;
+                if(pending.back().bp == prefix_bp) {
+                    top->expr = operand;
+                }
+                else {
+                    top->right = operand;
+                }
+                operand = top;
+                pending.pop_back();
             }
-            else {
-                biop->type = nt::biop_div;
+            if(op.infix_bp) {
+                Node* biop = arena.make<Node>();
+                biop->type = op.infix;
+                biop->left = operand;
+                pending.push_back({ biop, op.infix_bp });
+                next();
+                assert_not_eof(cur(), op.operand);
+                break;
+            }
+            if(pending.size() == bottom) {
+                return operand;
             }
+            // Only an open paren is left on top
+            assert_for(tt::rparen, cur());
             next();
-
-            assert_not_eof(cur(), "unit");
-            Node* right = parse_unit();
-
-            biop->left = term_root;
-            biop->right = right;
-            term_root = biop;
+            Node* group = pending.back().node;
+            group->expr = operand;
+            operand = group;
+            pending.pop_back();
         }
-
-        return term_root;
     }
+}
 
-    Node* parse_unit() {
-        if(cur().type == tt::plus) {
-            Node* result = new Node;
-            result->type = nt::unary_plus;
-            result->token = cur();
-            next();
-            result->expr = parse_unit();
-            return result;
-        }
-        if(cur().type == tt::minus) {
-            Node* result = new Node;
-            result->type = nt::unary_minus;
-            result->token = cur();
-            next();
-            result->expr = parse_unit();
-            return result;
-        }
-        if(cur().type != tt::lparen) {
-            return parse_lit();
-        }
-
-        next();
-        Node* result = new Node;
-        result->type = nt::paren_group;
-        result->expr = parse_expr();
-
-        assert_for(tt::rparen, cur());
+Node* Parser::parse_lit() {
+    Node* result = arena.make<Node>();
+    if(cur().type == tt::integer) {
+        result->type = nt::lit_int;
+        result->ival = cur().ival;
         next();
-
-        return result;
-    }
-
-    Node* parse_lit() {
-        Node* result = new Node;
-        if(cur().type == tt::integer) {
-            result->type = nt::lit_int;
-            result->token = cur();
-            result->ival = cur().ival;
-            next();
-        }
-        else if(cur().type == tt::id) {
-            result->type = nt::lit_id;
-            result->token = cur();
-            result->id = cur().id;
-            next();
-        }
-        else {
-            expected_but_found("literal", cur());
-        }
-        return result;
     }
-
-    Token cur() {
-        if(idx < tokens.size()) {
-            return tokens[idx];
-        }
-        return { .type = tt::eof };
-    }
-
-    Token next() {
-        ++idx;
-        return cur();
+    else if(cur().type == tt::id) {
+        result->type = nt::lit_id;
+        result->sym = cur().sym;
+        next();
     }
-
-    Token peek() {
-        if(idx + 1 < tokens.size()) {
-            return tokens[idx + 1];
-        }
-        return make_eof_token();
+    else {
+        expected_but_found("literal", cur());
     }
+    return result;
+}
 
-    Token make_eof_token() {
-        return { .type = TokenType::eof };
+const Token& Parser::next() {
+    if(spans) {
+        consumed_end = cur().lexeme.data() + cur().lexeme.size();
     }
-
-};
-
+    token = scanner.next_token();
+    return token;
+}
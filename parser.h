@@ -0,0 +1,79 @@
+#pragma once
+#include "gavcc.h"
+#include "scanner.h"
+
+// Where a statement sits in the source, for IncrementalParser. Offsets are
+// relative to the start of the enclosing statement, or of the parsed text
+// at the top level, so an edit only has to shift the statements after it
+// along its own path. inner holds the statements of a block, or the body
+// of a while.
+struct StmtSpan {
+    Node* node;
+    uint32_t start;
+    uint32_t end;
+    vector<StmtSpan> inner;
+};
+
+// Pulls tokens from the scanner on demand, keeping only the current one
+// so memory stays constant regardless of input size
+class Parser {
+    Scanner& scanner;
+    Token token;
+    Arena& arena;
+    // A block or while whose statements or body are still being parsed
+    struct OpenStmt {
+        Node* node;
+        vector<Node*> stmts;
+        const char* start;
+        // Spans of its statements, when recording spans
+        vector<StmtSpan> inner;
+    };
+    // Innermost last. Statements nest through these instead of through
+    // the call stack, so nesting depth is only bounded by memory.
+    vector<OpenStmt> open_stmts;
+    // Prefix operators, open parens and binary operators still waiting
+    // for an operand, see parse_expr
+    struct PendingOp {
+        Node* node;
+        // Binding power, 0 for a paren
+        uint8_t bp;
+    };
+    vector<PendingOp> pending;
+    // Only set while parse_stmts is recording spans
+    vector<StmtSpan>* spans = nullptr;
+    const char* span_base = nullptr;
+    const char* consumed_end = nullptr;
+
+public:
+    Parser(Scanner& scanner, Arena& arena);
+    Node* parse();
+
+    // Parses statements up to eof and records where each one is, relative
+    // to base, the start of the scanned text
+    vector<Node*> parse_stmts(const char* base, vector<StmtSpan>& out);
+
+private:
+    Node* parse_stmt();
+
+    // Parses a whole simple statement, or opens a block or while and
+    // returns nullptr
+    Node* start_stmt();
+
+    // Pops the innermost open statement, which is complete
+    Node* close_stmt();
+    void record_span(Node* node, const char* start, vector<StmtSpan> inner);
+
+    // Everything up to the body, which parse_stmt fills in
+    Node* parse_while();
+    Node* parse_stmt_decl();
+    Node* parse_stmt_assn();
+    Node* parse_stmt_return();
+    Node* parse_expr();
+    Node* parse_lit();
+
+    const Token& cur() {
+        return token;
+    }
+
+    const Token& next();
+};
@@ -0,0 +1,265 @@
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::endl;
+using std::string;
+template <typename T>
+using vector = std::vector<T>;
+
+// Writes a random gavcc program to stdout for the benchmarks. The same
+// shape, size and seed always give the same program, so results can be
+// compared across builds. Every program is valid, terminates and keeps
+// its values well inside int64_t: divisions are by nonzero literals and
+// nothing is multiplied by more than a small constant.
+//
+//   deep    blocks nested size levels deep
+//   chain   long chains of + and - mixed with parens, size terms in all
+//   ops     long chains of every operator, prefix ones and parens
+//           included, size terms in all
+//   decls   size declarations, each computed from earlier ones
+//   loop    hot while loops, size iterations of the innermost body in all
+//   mixed   all of the above: size / 100 levels, size / 2 terms and
+//           declarations, size * 10 iterations
+class ProgramGen {
+    std::mt19937_64 rng;
+    string out;
+
+public:
+    ProgramGen(uint64_t seed): rng(seed) {}
+
+    string gen(const string& shape, int64_t size) {
+        if(shape == "deep") {
+            deep("d", size);
+        }
+        else if(shape == "chain") {
+            chain("c", size);
+        }
+        else if(shape == "ops") {
+            ops("o", size);
+        }
+        else if(shape == "decls") {
+            decls("v", size);
+        }
+        else if(shape == "loop") {
+            loop("l", size);
+        }
+        else {
+            deep("d", std::max<int64_t>(size / 100, 1));
+            chain("c", size / 2);
+            decls("v", size / 2);
+            loop("l", size * 10);
+        }
+        return out;
+    }
+
+private:
+    void deep(const string& prefix, int64_t depth) {
+        string var = name(prefix, 0);
+        writeln(std::format("int {};", var));
+        writeln(std::format("{} = {};", var, pick(1, 9)));
+        for(int64_t level = 1; level <= depth; ++level) {
+            string inner = name(prefix, level);
+            writeln("{");
+            writeln(std::format("int {};", inner));
+            writeln(std::format("{} = {} / 2 + {};", inner, var, pick(1, 99)));
+            var = inner;
+        }
+        writeln(std::format("{} = {};", name(prefix, 0), var));
+        for(int64_t level = 0; level < depth; ++level) {
+            writeln("}");
+        }
+        writeln(std::format("return {};", name(prefix, 0)));
+    }
+
+    // Statements of at most 500 terms, since the passes recurse along the
+    // left spine of an expression
+    void chain(const string& prefix, int64_t terms) {
+        vector<string> inputs;
+        for(int i = 0; i < 8; ++i) {
+            inputs.push_back(name(prefix, i));
+            writeln(std::format("int {};", inputs.back()));
+            writeln(std::format("{} = {};", inputs.back(), pick(-99, 99)));
+        }
+        string result = prefix + "sum";
+        writeln(std::format("int {};", result));
+        writeln(std::format("{} = 0;", result));
+        while(terms > 0) {
+            int64_t count = std::min<int64_t>(terms, 500);
+            terms -= count;
+            string expr = term(inputs);
+            for(int64_t i = 1; i < count; ++i) {
+                expr += pick(0, 1) ? " + " : " - ";
+                expr += term(inputs);
+            }
+            writeln(std::format("{} = {} / 4 + {};", result, result, expr));
+        }
+        writeln(std::format("return {};", result));
+    }
+
+    // Products of up to three factors between the + and -, so the parser
+    // switches precedence every few tokens
+    void ops(const string& prefix, int64_t terms) {
+        vector<string> inputs;
+        for(int i = 0; i < 8; ++i) {
+            inputs.push_back(name(prefix, i));
+            writeln(std::format("int {};", inputs.back()));
+            writeln(std::format("{} = {};", inputs.back(), pick(-99, 99)));
+        }
+        string result = prefix + "sum";
+        writeln(std::format("int {};", result));
+        writeln(std::format("{} = 0;", result));
+        while(terms > 0) {
+            int64_t count = std::min<int64_t>(terms, 500);
+            terms -= count;
+            string expr = product(inputs);
+            for(int64_t i = 1; i < count; ++i) {
+                expr += pick(0, 1) ? " + " : " - ";
+                expr += product(inputs);
+            }
+            writeln(std::format("{} = {} / 4 + {};", result, result, expr));
+        }
+        writeln(std::format("return {};", result));
+    }
+
+    void decls(const string& prefix, int64_t count) {
+        for(int64_t i = 0; i < count; ++i) {
+            string var = name(prefix, i);
+            writeln(std::format("int {};", var));
+            if(i < 2) {
+                writeln(std::format("{} = {};", var, pick(-99, 99)));
+                continue;
+            }
+            int64_t a = pick(0, i - 1);
+            int64_t b = pick(std::max<int64_t>(0, i - 16), i - 1);
+            writeln(std::format("{} = {} / 2 - {} / 2 + {};", var, name(prefix, a), name(prefix, b), pick(-9, 9)));
+        }
+        writeln(std::format("return {};", name(prefix, count - 1)));
+    }
+
+    // An outer loop around an inner one, so both the loop header and the
+    // body are hot
+    void loop(const string& prefix, int64_t iterations) {
+        int64_t outer = std::max<int64_t>(iterations / 10000, 1);
+        int64_t inner = std::max<int64_t>(iterations / outer, 1);
+        string i = prefix + "i";
+        string j = prefix + "j";
+        string acc = prefix + "acc";
+        string step = prefix + "step";
+        for(const string& var : { i, j, acc, step }) {
+            writeln(std::format("int {};", var));
+        }
+        writeln(std::format("{} = 0;", acc));
+        writeln(std::format("{} = {};", step, pick(2, 9)));
+        writeln(std::format("{} = {};", i, outer));
+        writeln(std::format("while({}) {{", i));
+        writeln(std::format("    {} = {};", j, inner));
+        writeln(std::format("    while({}) {{", j));
+        writeln(std::format("        {} = {} / 2 + {} * {} - ({} - {});", acc, acc, j, step, i, pick(1, 99)));
+        writeln(std::format("        {} = {} - 1;", j, j));
+        writeln("    }");
+        writeln(std::format("    {} = {} - 1;", i, i));
+        writeln("}");
+        writeln(std::format("return {};", acc));
+    }
+
+    // A variable, a literal, or a small parenthesized product or quotient
+    string term(const vector<string>& inputs) {
+        switch(pick(0, 5)) {
+            case 0:
+                return std::to_string(pick(1, 999));
+            case 1:
+                return std::format("({} * {})", inputs[pick(0, inputs.size() - 1)], pick(2, 9));
+            case 2:
+                return std::format("({} / {})", inputs[pick(0, inputs.size() - 1)], pick(2, 9));
+            case 3:
+                return std::format("-{}", inputs[pick(0, inputs.size() - 1)]);
+            default:
+                return inputs[pick(0, inputs.size() - 1)];
+        }
+    }
+
+    // At most three factors of magnitude 198 or less, and divisions by
+    // nonzero literals
+    string product(const vector<string>& inputs) {
+        string expr = factor(inputs);
+        for(int64_t i = pick(0, 2); i > 0; --i) {
+            expr += std::format(" * {}", factor(inputs));
+        }
+        if(pick(0, 1)) {
+            expr += std::format(" / {}", pick(1, 9));
+        }
+        return expr;
+    }
+
+    string factor(const vector<string>& inputs) {
+        const string& var = inputs[pick(0, inputs.size() - 1)];
+        switch(pick(0, 4)) {
+            case 0:
+                return std::to_string(pick(1, 9));
+            case 1:
+                return "-" + var;
+            case 2:
+                return std::format("({} - {})", var, inputs[pick(0, inputs.size() - 1)]);
+            case 3:
+                return std::format("-({} + {})", var, pick(1, 99));
+            default:
+                return var;
+        }
+    }
+
+    // Identifiers are letters only, so n is spelled in base 26
+    static string name(const string& prefix, int64_t n) {
+        string digits;
+        do {
+            digits += (char)('a' + n % 26);
+            n /= 26;
+        } while(n > 0);
+        return prefix + string(digits.rbegin(), digits.rend());
+    }
+
+    int64_t pick(int64_t lo, int64_t hi) {
+        return std::uniform_int_distribution<int64_t>(lo, hi)(rng);
+    }
+
+    void writeln(const string& s) {
+        out += s;
+        out += '\n';
+    }
+};
+
+int main(int argc, char** argv) {
+    string shape = "mixed";
+    int64_t size = -1;
+    uint64_t seed = 1;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if(arg.starts_with("--shape=")) {
+            shape = arg.substr(string("--shape=").size());
+        }
+        else if(arg.starts_with("--size=")) {
+            size = std::stoll(arg.substr(string("--size=").size()));
+        }
+        else if(arg.starts_with("--seed=")) {
+            seed = std::stoull(arg.substr(string("--seed=").size()));
+        }
+        else {
+            cout << "Unknown option: " << arg << endl;
+            return 1;
+        }
+    }
+    if(shape != "deep" && shape != "chain" && shape != "ops" && shape != "decls" && shape != "loop" && shape != "mixed") {
+        cout << "Unknown shape: " << shape << endl;
+        return 1;
+    }
+    // Defaults sized for a few milliseconds to a second per phase
+    if(size < 0) {
+        size = shape == "deep" ? 2000 : shape == "decls" ? 50000 : shape == "loop" ? 2000000 : 200000;
+    }
+    cout << ProgramGen(seed).gen(shape, size);
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include "regalloc.h"
+#include <algorithm>
+#include <format>
+
+// The range of instructions a virtual register is live over, inclusive.
+// Intervals have no holes: a variable that is live on entry to a loop and
+// still needed after the back edge is live across the whole loop body.
+struct LiveInterval {
+    int32_t vreg;
+    int32_t start;
+    int32_t end;
+};
+
+namespace regalloc {
+    // The register an instruction writes, or -1
+    int32_t def(const Instr& in) {
+        switch(in.op) {
+            case Op::load_const:
+            case Op::mov:
+            case Op::add:
+            case Op::sub:
+            case Op::mul:
+            case Op::div:
+            case Op::neg:
+                return in.a;
+        }
+        return -1;
+    }
+
+    // Fills uses with the registers an instruction reads, returns how many
+    int uses(const Instr& in, int32_t uses[2]) {
+        switch(in.op) {
+            case Op::mov:
+            case Op::neg:
+                uses[0] = in.b;
+                return 1;
+            case Op::add:
+            case Op::sub:
+            case Op::mul:
+            case Op::div:
+                uses[0] = in.b;
+                uses[1] = in.c;
+                return 2;
+            case Op::jnz:
+            case Op::print:
+            case Op::check:
+                uses[0] = in.a;
+                return 1;
+        }
+        return 0;
+    }
+}
+
+// Live intervals for the registers of a Chunk built without temporary
+// reuse. Temporaries never outlive the statement that made them, so they
+// are defined and used inside one basic block and their intervals come
+// straight from their def and uses. Variables can be live across jumps,
+// so they get a backward dataflow pass over the basic blocks, iterated
+// until the while loop back edges stop adding anything.
+class Liveness {
+    const Chunk& chunk;
+    // Bit sets over the variables, one word_count sized row per block
+    size_t word_count;
+    vector<int32_t> block_starts;
+    vector<uint64_t> live_in;
+    vector<uint64_t> live_out;
+    vector<uint64_t> use;
+    vector<uint64_t> kill;
+    vector<int32_t> start;
+    vector<int32_t> end;
+
+public:
+    Liveness(const Chunk& chunk): chunk(chunk), word_count((chunk.num_vars + 63) / 64) {}
+
+    // Sorted by start
+    vector<LiveInterval> intervals() {
+        start.assign(chunk.num_regs, INT32_MAX);
+        end.assign(chunk.num_regs, -1);
+        find_blocks();
+        solve();
+        for(size_t b = 0; b < block_starts.size(); ++b) {
+            int32_t first = block_starts[b];
+            int32_t last = block_end(b) - 1;
+            for_each_bit(&live_in[b * word_count], [&](int32_t v) { extend(v, first); });
+            for_each_bit(&live_out[b * word_count], [&](int32_t v) { extend(v, last); });
+        }
+        for(size_t i = 0; i < chunk.code.size(); ++i) {
+            const Instr& in = chunk.code[i];
+            int32_t used[2];
+            int n = regalloc::uses(in, used);
+            for(int u = 0; u < n; ++u) {
+                extend(used[u], i);
+            }
+            int32_t d = regalloc::def(in);
+            if(d >= 0) {
+                extend(d, i);
+            }
+        }
+        vector<LiveInterval> out;
+        for(int32_t v = 0; v < chunk.num_regs; ++v) {
+            if(end[v] >= 0) {
+                out.push_back({ v, start[v], end[v] });
+            }
+        }
+        std::sort(out.begin(), out.end(), [](const LiveInterval& a, const LiveInterval& b) {
+            return a.start < b.start;
+        });
+        return out;
+    }
+
+private:
+    void find_blocks() {
+        size_t size = chunk.code.size();
+        vector<bool> leader(size + 1);
+        leader[0] = true;
+        for(size_t i = 0; i < size; ++i) {
+            const Instr& in = chunk.code[i];
+            if(in.op == Op::jmp) {
+                leader[in.a] = true;
+                leader[i + 1] = true;
+            }
+            else if(in.op == Op::jnz) {
+                leader[in.b] = true;
+                leader[i + 1] = true;
+            }
+            else if(in.op == Op::halt) {
+                leader[i + 1] = true;
+            }
+        }
+        for(size_t i = 0; i < size; ++i) {
+            if(leader[i]) {
+                block_starts.push_back(i);
+            }
+        }
+    }
+
+    int32_t block_end(size_t b) {
+        return b + 1 < block_starts.size() ? block_starts[b + 1] : chunk.code.size();
+    }
+
+    size_t block_of(int32_t pc) {
+        return std::upper_bound(block_starts.begin(), block_starts.end(), pc) - block_starts.begin() - 1;
+    }
+
+    void solve() {
+        size_t count = block_starts.size();
+        live_in.assign(count * word_count, 0);
+        live_out.assign(count * word_count, 0);
+        use.assign(count * word_count, 0);
+        kill.assign(count * word_count, 0);
+        vector<vector<size_t>> succs(count);
+        for(size_t b = 0; b < count; ++b) {
+            uint64_t* b_use = &use[b * word_count];
+            uint64_t* b_kill = &kill[b * word_count];
+            for(int32_t i = block_starts[b]; i < block_end(b); ++i) {
+                const Instr& in = chunk.code[i];
+                int32_t used[2];
+                int n = regalloc::uses(in, used);
+                for(int u = 0; u < n; ++u) {
+                    if(is_var(used[u]) && !test(b_kill, used[u])) {
+                        set(b_use, used[u]);
+                    }
+                }
+                int32_t d = regalloc::def(in);
+                if(is_var(d)) {
+                    set(b_kill, d);
+                }
+            }
+            const Instr& last = chunk.code[block_end(b) - 1];
+            if(last.op == Op::jmp) {
+                succs[b].push_back(block_of(last.a));
+            }
+            else if(last.op != Op::halt) {
+                if(last.op == Op::jnz) {
+                    succs[b].push_back(block_of(last.b));
+                }
+                if(b + 1 < count) {
+                    succs[b].push_back(b + 1);
+                }
+            }
+        }
+
+        // Walking the blocks backwards converges in one pass for straight
+        // line code, each enclosing loop costs another
+        bool changed = true;
+        while(changed) {
+            changed = false;
+            for(size_t b = count; b-- > 0;) {
+                uint64_t* out = &live_out[b * word_count];
+                uint64_t* in = &live_in[b * word_count];
+                for(size_t succ : succs[b]) {
+                    const uint64_t* succ_in = &live_in[succ * word_count];
+                    for(size_t w = 0; w < word_count; ++w) {
+                        out[w] |= succ_in[w];
+                    }
+                }
+                for(size_t w = 0; w < word_count; ++w) {
+                    uint64_t next = use[b * word_count + w] | (out[w] & ~kill[b * word_count + w]);
+                    if(next != in[w]) {
+                        in[w] = next;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    void extend(int32_t v, int32_t pc) {
+        start[v] = std::min(start[v], pc);
+        end[v] = std::max(end[v], pc);
+    }
+
+    bool is_var(int32_t v) {
+        return v >= 0 && v < chunk.num_vars;
+    }
+
+    static bool test(const uint64_t* bits, int32_t v) {
+        return bits[v / 64] >> (v % 64) & 1;
+    }
+
+    static void set(uint64_t* bits, int32_t v) {
+        bits[v / 64] |= uint64_t(1) << (v % 64);
+    }
+
+    template<typename F>
+    void for_each_bit(const uint64_t* bits, F f) {
+        for(size_t w = 0; w < word_count; ++w) {
+            uint64_t word = bits[w];
+            while(word) {
+                f(w * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+};
+
+RegAlloc LinearScan::alloc() {
+    RegAlloc result;
+    result.reg.assign(chunk.num_regs, -1);
+    result.slot.assign(chunk.num_regs, -1);
+    vector<LiveInterval> intervals = Liveness(chunk).intervals();
+    result.num_intervals = intervals.size();
+
+    // Sorted by end so expiring pops from the front
+    vector<LiveInterval> active;
+    vector<int32_t> free_regs;
+    for(int32_t r = num_regs - 1; r >= 0; --r) {
+        free_regs.push_back(r);
+    }
+    auto by_end = [](const LiveInterval& a, const LiveInterval& b) {
+        return a.end < b.end;
+    };
+    for(const LiveInterval& cur : intervals) {
+        size_t expired = 0;
+        while(expired < active.size() && active[expired].end < cur.start) {
+            free_regs.push_back(result.reg[active[expired].vreg]);
+            ++expired;
+        }
+        active.erase(active.begin(), active.begin() + expired);
+        // Keep handing out the lowest free register
+        std::sort(free_regs.begin(), free_regs.end(), std::greater<int32_t>());
+
+        if(!free_regs.empty()) {
+            result.reg[cur.vreg] = free_regs.back();
+            free_regs.pop_back();
+            active.insert(std::upper_bound(active.begin(), active.end(), cur, by_end), cur);
+            continue;
+        }
+        if(!active.empty() && active.back().end > cur.end) {
+            LiveInterval victim = active.back();
+            active.pop_back();
+            result.reg[cur.vreg] = result.reg[victim.vreg];
+            result.reg[victim.vreg] = -1;
+            result.slot[victim.vreg] = result.num_slots++;
+            active.insert(std::upper_bound(active.begin(), active.end(), cur, by_end), cur);
+        }
+        else {
+            result.slot[cur.vreg] = result.num_slots++;
+        }
+    }
+    for(int32_t r : result.reg) {
+        result.num_regs = std::max(result.num_regs, r + 1);
+    }
+    return result;
+}
+
+namespace to_string {
+    string reg_alloc(const RegAlloc& alloc) {
+        return std::format("regalloc: {} intervals, {} registers, {} spilled",
+            alloc.num_intervals, alloc.num_regs, alloc.num_slots);
+    }
+}
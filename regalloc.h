@@ -0,0 +1,33 @@
+#pragma once
+#include "gavcc.h"
+#include "bytecode.h"
+
+// Where LinearScan put each virtual register of a Chunk. A register is
+// either in reg[vreg], an index into the target's register pool, or in
+// spill slot slot[vreg]. Registers that are never used have neither.
+struct RegAlloc {
+    vector<int32_t> reg;
+    vector<int32_t> slot;
+    int32_t num_regs = 0;
+    int32_t num_slots = 0;
+    int32_t num_intervals = 0;
+};
+
+// Poletto and Sarkar's linear scan over the intervals from Liveness.
+// Registers are handed out lowest index first, so a target can put the
+// registers it would rather use at the front of its pool. When all of
+// them are taken the interval that ends last is spilled, which keeps
+// short lived temporaries and loop counters in registers.
+class LinearScan {
+    const Chunk& chunk;
+    int32_t num_regs;
+
+public:
+    LinearScan(const Chunk& chunk, int32_t num_regs): chunk(chunk), num_regs(num_regs) {}
+
+    RegAlloc alloc();
+};
+
+namespace to_string {
+    string reg_alloc(const RegAlloc& alloc);
+}
@@ -0,0 +1,116 @@
+#include "report.h"
+#include <cstdlib>
+#include <format>
+#include <new>
+#include <sys/resource.h>
+#include <time.h>
+
+// Counts every allocation made through operator new, for --time-report.
+// The counters are per thread, so the batch mode's workers don't contend
+// on them, and the report covers the thread that runs the pipeline. The
+// replacements stay out of line: inlined into a caller, GCC sees free()
+// called on the result of new and warns.
+thread_local uint64_t alloc_count = 0;
+thread_local uint64_t alloc_bytes = 0;
+
+[[gnu::noinline]] void* operator new(size_t size) {
+    ++alloc_count;
+    alloc_bytes += size;
+    if(void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void TimeReport::start(string name) {
+    phases.push_back({ std::move(name) });
+    allocs_start = alloc_count;
+    bytes_start = alloc_bytes;
+    cpu_start = cpu_ms();
+    wall_start = clock::now();
+}
+
+void TimeReport::stop() {
+    PhaseStats& phase = phases.back();
+    phase.wall_ms = std::chrono::duration<double, std::milli>(clock::now() - wall_start).count();
+    phase.cpu_ms = cpu_ms() - cpu_start;
+    phase.allocs = alloc_count - allocs_start;
+    phase.alloc_bytes = alloc_bytes - bytes_start;
+    phase.peak_rss_kb = peak_rss_kb();
+}
+
+string TimeReport::table() const {
+    string out = std::format("{:<10} {:>10} {:>10} {:>10} {:>12} {:>12}\n",
+        "phase", "wall (ms)", "cpu (ms)", "allocs", "alloc bytes", "peak RSS KB");
+    for(const PhaseStats& phase : with_total()) {
+        out += std::format("{:<10} {:>10.3f} {:>10.3f} {:>10} {:>12} {:>12}\n",
+            phase.name, phase.wall_ms, phase.cpu_ms, phase.allocs, phase.alloc_bytes, phase.peak_rss_kb);
+    }
+    out += std::format("{} tokens, {} nodes\n", tokens, nodes);
+    return out;
+}
+
+string TimeReport::json() const {
+    vector<PhaseStats> all = with_total();
+    string out = std::format("{{\"input\": \"{}\", \"tokens\": {}, \"nodes\": {}, \"phases\": [",
+        json_escape(input), tokens, nodes);
+    for(size_t i = 0; i < all.size(); ++i) {
+        const PhaseStats& phase = all[i];
+        out += std::format("{}{{\"name\": \"{}\", \"wall_ms\": {:.3f}, \"cpu_ms\": {:.3f}, "
+            "\"allocs\": {}, \"alloc_bytes\": {}, \"peak_rss_kb\": {}}}",
+            i ? ", " : "", phase.name, phase.wall_ms, phase.cpu_ms, phase.allocs, phase.alloc_bytes, phase.peak_rss_kb);
+    }
+    out += "]}\n";
+    return out;
+}
+
+vector<PhaseStats> TimeReport::with_total() const {
+    vector<PhaseStats> all = phases;
+    PhaseStats total{ "total" };
+    for(const PhaseStats& phase : phases) {
+        total.wall_ms += phase.wall_ms;
+        total.cpu_ms += phase.cpu_ms;
+        total.allocs += phase.allocs;
+        total.alloc_bytes += phase.alloc_bytes;
+        total.peak_rss_kb = std::max(total.peak_rss_kb, phase.peak_rss_kb);
+    }
+    all.push_back(total);
+    return all;
+}
+
+double TimeReport::cpu_ms() {
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+long TimeReport::peak_rss_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+string TimeReport::json_escape(std::string_view s) {
+    string out;
+    for(char c : s) {
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if((unsigned char)c < 0x20) {
+            out += std::format("\\u{:04x}", c);
+        }
+        else {
+            out += c;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "gavcc.h"
+#include <chrono>
+
+struct PhaseStats {
+    string name;
+    double wall_ms = 0;
+    double cpu_ms = 0;
+    uint64_t allocs = 0;
+    uint64_t alloc_bytes = 0;
+    // Peak resident set of the process when the phase ended
+    long peak_rss_kb = 0;
+};
+
+// Wall and CPU time, allocations and peak RSS of each phase of a compile,
+// plus the size of the program. Phases are bracketed with start() and
+// stop() and reported in the order they ran.
+class TimeReport {
+    using clock = std::chrono::steady_clock;
+    vector<PhaseStats> phases;
+    clock::time_point wall_start;
+    double cpu_start = 0;
+    uint64_t allocs_start = 0;
+    uint64_t bytes_start = 0;
+
+public:
+    string input;
+    size_t tokens = 0;
+    size_t nodes = 0;
+
+    void start(string name);
+    void stop();
+    string table() const;
+
+    // One object per line, ready to append to a log of runs
+    string json() const;
+
+private:
+    vector<PhaseStats> with_total() const;
+    static double cpu_ms();
+    static long peak_rss_kb();
+    static string json_escape(std::string_view s);
+};
@@ -1,184 +1,314 @@
+#include <array>
 #include <charconv>
+#include <optional>
+#include <string_view>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
-#include "gavcc.h"
+#include "scanner.h"
 
 using tt = TokenType;
 
-class Scanner {
-    const std::string chars;
-    std::vector<Token> tokens;
-    uint idx = 0;
+enum class CharClass : uint8_t {
+    other,
+    whitespace,
+    id_start,
+    digit,
+    punct,
+    eof,
+};
 
-public:
-    Scanner(std::string chars): chars(chars) {}
+// One lookup per byte instead of a chain of comparisons
+constexpr std::array<CharClass, 256> char_classes = [] {
+    std::array<CharClass, 256> classes{};
+    for(char c : std::string_view(" \n\t")) {
+        classes[(uint8_t)c] = CharClass::whitespace;
+    }
+    for(int c = 'a'; c <= 'z'; ++c) {
+        classes[c] = CharClass::id_start;
+        classes[c - 'a' + 'A'] = CharClass::id_start;
+    }
+    for(int c = '0'; c <= '9'; ++c) {
+        classes[c] = CharClass::digit;
+    }
+    for(char c : std::string_view("{}()+-*/=;")) {
+        classes[(uint8_t)c] = CharClass::punct;
+    }
+    classes[(uint8_t)EOF] = CharClass::eof;
+    return classes;
+}();
 
-    std::vector<Token> scan() {
-        while(idx < chars.size()) {
-            char c = cur();
-            if(is_whitespace(c)) {
-                next();
-            }
-            else if(is_id_start(c)) {
-                scan_id();
-            }
-            else if(is_digit(c)) {
-                scan_number();
-            }
-            else if(c == '{') {
-                tokens.push_back({ .type = tt::lbrace,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == '}') {
-                tokens.push_back({ .type = tt::rbrace,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == '(') {
-                tokens.push_back({ .type = tt::lparen,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == ')') {
-                tokens.push_back({ .type = tt::rparen,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == '+') {
-                tokens.push_back({ .type = tt::plus,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == '-') {
-                tokens.push_back({ .type = tt::minus,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == '*') {
-                tokens.push_back({ .type = tt::star,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == '/') {
-                tokens.push_back({ .type = tt::div,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == '=') {
-                tokens.push_back({ .type = tt::equal,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == ';') {
-                tokens.push_back({ .type = tt::semicolon,
-                    .lexeme = std::to_string(c) });
-                next();
-            }
-            else if(c == EOF) {
-                tokens.push_back({ .type = tt::eof });
-                next();
-            }
-            else {
-                next();
-            }
-        }
-        return tokens;
+constexpr std::array<TokenType, 256> punct_types = [] {
+    std::array<TokenType, 256> types{};
+    types['{'] = tt::lbrace;
+    types['}'] = tt::rbrace;
+    types['('] = tt::lparen;
+    types[')'] = tt::rparen;
+    types['+'] = tt::plus;
+    types['-'] = tt::minus;
+    types['*'] = tt::star;
+    types['/'] = tt::div;
+    types['='] = tt::equal;
+    types[';'] = tt::semicolon;
+    return types;
+}();
+
+struct Keyword {
+    std::string_view spelling;
+    TokenType type;
+};
+
+// Adding a keyword only takes a new entry here
+constexpr Keyword keywords[] = {
+    { "int", tt::kw_int },
+    { "return", tt::kw_return },
+    { "while", tt::kw_while },
+};
+
+// Perfect hash over the keywords using the length and the first and last
+// characters. The slot table is built at compile time, and a collision
+// between two keywords fails the build, at which point the multipliers or
+// table size need adjusting.
+namespace keyword_hash {
+    constexpr size_t table_size = 64;
+
+    constexpr size_t hash(std::string_view s) {
+        return (s.size() * 7 + (uint8_t)s.front() * 3 + (uint8_t)s.back()) % table_size;
     }
 
-private:
-    char cur() {
-        if(idx < chars.size()) {
-            return chars[idx];
+    constexpr std::array<int8_t, table_size> slots = [] {
+        std::array<int8_t, table_size> slots{};
+        slots.fill(-1);
+        for(size_t i = 0; i < std::size(keywords); ++i) {
+            slots[hash(keywords[i].spelling)] = i;
+        }
+        return slots;
+    }();
+
+    consteval bool is_perfect() {
+        for(size_t i = 0; i < std::size(keywords); ++i) {
+            if(slots[hash(keywords[i].spelling)] != (int8_t)i) {
+                return false;
+            }
         }
-        return EOF;
+        return true;
     }
+    static_assert(is_perfect(), "keyword hash collision");
+}
 
-    char next() {
-        ++idx;
-        return cur();
+// One hash and at most one comparison, ids are never empty
+constexpr std::optional<TokenType> keyword_type(std::string_view id_text) {
+    int8_t slot = keyword_hash::slots[keyword_hash::hash(id_text)];
+    if(slot >= 0 && keywords[slot].spelling == id_text) {
+        return keywords[slot].type;
     }
+    return std::nullopt;
+}
 
-    char peek() {
-        if(idx + 1 < chars.size()) {
-            return chars[idx + 1];
+// Span kernels: each returns the index of the first byte at or after i
+// that is not in its class, or size if the run reaches the end. Most runs
+// in hand written code are a few bytes long, so the vector versions check
+// a short scalar prefix before switching to whole 16/32 byte blocks, and
+// finish the tail with the scalar version so they never read past the
+// buffer.
+namespace char_span {
+    constexpr size_t scalar_prefix = 8;
+
+    size_t whitespace_scalar(const char* s, size_t i, size_t size) {
+        while(i < size && char_classes[(uint8_t)s[i]] == CharClass::whitespace) {
+            ++i;
         }
-        return EOF;
+        return i;
     }
 
-    void scan_id() {
-        int start = idx;
-        int end = idx;
-        char c = cur();
-        while(is_id_char(c)) {
-            ++end;
-            c = next();
-        }
-        std::string id_text(&chars[start], end - start);
-        if(is_kw(id_text)) {
-            tokens.push_back(scan_kw(id_text));
+    size_t id_chars_scalar(const char* s, size_t i, size_t size) {
+        while(i < size && (char_classes[(uint8_t)s[i]] == CharClass::id_start || s[i] == '_')) {
+            ++i;
         }
-        else {
-            tokens.push_back({ .type = tt::id, .lexeme = id_text, .id = id_text });
+        return i;
+    }
+
+    size_t digits_scalar(const char* s, size_t i, size_t size) {
+        while(i < size && char_classes[(uint8_t)s[i]] == CharClass::digit) {
+            ++i;
         }
+        return i;
+    }
+
+#if defined(__x86_64__)
+    // Byte lanes in [lo, hi], as a signed compare. Non ASCII bytes are
+    // negative and never match.
+    inline __m128i in_range_sse2(__m128i v, char lo, char hi) {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                             _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+    }
+
+    inline __m128i whitespace_sse2(__m128i v) {
+        return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+               _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                            _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
     }
 
-    void scan_number() {
-        int start = idx;
-        int len = 0;
-        char c = cur();
-        while(is_digit(c)) {
-            ++len;
-            c = next();
+    inline __m128i id_chars_sse2(__m128i v) {
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        return _mm_or_si128(in_range_sse2(lower, 'a', 'z'),
+                            _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    }
+
+    inline __m128i digits_sse2(__m128i v) {
+        return in_range_sse2(v, '0', '9');
+    }
+
+    template <__m128i (*matches)(__m128i), SpanFn tail>
+    size_t span_sse2(const char* s, size_t i, size_t size) {
+        size_t prefix_end = tail(s, i, i + scalar_prefix < size ? i + scalar_prefix : size);
+        if(prefix_end < i + scalar_prefix) {
+            return prefix_end;
         }
-        string lexeme(chars, start, len);
-        int value;
-        std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), value);
-        tokens.push_back({ .type = tt::integer, .lexeme = lexeme, .ival = value });
-    }
-
-    bool is_whitespace(char c) {
-        switch(c) {
-            case ' ':
-            case '\n':
-            case '\t':
-                return true;
-            default:
-                return false;
+        i = prefix_end;
+        while(i + 16 <= size) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            uint32_t misses = ~_mm_movemask_epi8(matches(v)) & 0xFFFF;
+            if(misses) {
+                return i + __builtin_ctz(misses);
+            }
+            i += 16;
         }
+        return tail(s, i, size);
     }
 
-    bool is_id_start(char c) {
-        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+    __attribute__((target("avx2")))
+    inline __m256i in_range_avx2(__m256i v, char lo, char hi) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
     }
 
-    bool is_id_char(char c) {
-        return is_id_start(c) || c == '_';
+    __attribute__((target("avx2")))
+    inline __m256i whitespace_avx2(__m256i v) {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+               _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
     }
 
-    bool is_digit(char c) {
-        return c >= '0' && c <= '9';
+    __attribute__((target("avx2")))
+    inline __m256i id_chars_avx2(__m256i v) {
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        return _mm256_or_si256(in_range_avx2(lower, 'a', 'z'),
+                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
     }
 
-    bool is_kw(std::string id_text) {
-        if(id_text == "int"
-            || id_text == "return"
-            || id_text == "while") {
-            return true;
+    __attribute__((target("avx2")))
+    inline __m256i digits_avx2(__m256i v) {
+        return in_range_avx2(v, '0', '9');
+    }
+
+    template <__m256i (*matches)(__m256i), __m128i (*narrow)(__m128i), SpanFn tail>
+    __attribute__((target("avx2")))
+    size_t span_avx2(const char* s, size_t i, size_t size) {
+        size_t prefix_end = tail(s, i, i + scalar_prefix < size ? i + scalar_prefix : size);
+        if(prefix_end < i + scalar_prefix) {
+            return prefix_end;
+        }
+        i = prefix_end;
+        while(i + 32 <= size) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+            uint32_t misses = ~(uint32_t)_mm256_movemask_epi8(matches(v));
+            if(misses) {
+                return i + __builtin_ctz(misses);
+            }
+            i += 32;
         }
-        return false;
+        return span_sse2<narrow, tail>(s, i, size);
     }
+#endif
 
-    Token scan_kw(std::string lexeme) {
-        if(lexeme == "int") {
-            return { .type = tt::kw_int, .lexeme = lexeme };
+    ScanSimd best() {
+#if defined(__x86_64__)
+        if(__builtin_cpu_supports("avx2")) {
+            return ScanSimd::avx2;
         }
-        if(lexeme == "return") {
-            return { .type = tt::kw_return, .lexeme = lexeme };
+        return ScanSimd::sse2;
+#else
+        return ScanSimd::scalar;
+#endif
+    }
+
+    Kernels kernels(ScanSimd simd) {
+        switch(simd) {
+#if defined(__x86_64__)
+            case ScanSimd::avx2:
+                return {
+                    span_avx2<whitespace_avx2, whitespace_sse2, whitespace_scalar>,
+                    span_avx2<id_chars_avx2, id_chars_sse2, id_chars_scalar>,
+                    span_avx2<digits_avx2, digits_sse2, digits_scalar>,
+                };
+            case ScanSimd::sse2:
+                return {
+                    span_sse2<whitespace_sse2, whitespace_scalar>,
+                    span_sse2<id_chars_sse2, id_chars_scalar>,
+                    span_sse2<digits_sse2, digits_scalar>,
+                };
+#endif
+            default:
+                return { whitespace_scalar, id_chars_scalar, digits_scalar };
         }
-        if(lexeme == "while") {
-            return { .type = tt::kw_while, .lexeme = lexeme };
+    }
+}
+
+std::vector<Token> Scanner::scan() {
+    std::vector<Token> tokens;
+    for(Token token = next_token(); token.type != tt::eof; token = next_token()) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+Token Scanner::next_token() {
+    while(idx < chars.size()) {
+        char c = chars[idx];
+        switch(char_classes[(uint8_t)c]) {
+            case CharClass::whitespace:
+                idx = spans.whitespace(chars.data(), idx, chars.size());
+                break;
+            case CharClass::id_start:
+                return scan_id();
+            case CharClass::digit:
+                return scan_number();
+            case CharClass::punct:
+                return punct(punct_types[(uint8_t)c]);
+            case CharClass::eof:
+                ++idx;
+                return { .type = tt::eof };
+            case CharClass::other:
+                ++idx;
+                break;
         }
-        exit(5);
     }
+    return { .type = tt::eof };
+}
 
-};
+Token Scanner::punct(tt type) {
+    Token token = { .type = type, .lexeme = chars.substr(idx, 1) };
+    ++idx;
+    return token;
+}
+
+Token Scanner::scan_id() {
+    size_t start = idx;
+    idx = spans.id_chars(chars.data(), idx, chars.size());
+    std::string_view id_text = chars.substr(start, idx - start);
+    if(std::optional<tt> kw = keyword_type(id_text)) {
+        return { .type = *kw, .lexeme = id_text };
+    }
+    return { .type = tt::id, .sym = names.intern(id_text), .lexeme = id_text };
+}
+
+Token Scanner::scan_number() {
+    size_t start = idx;
+    idx = spans.digits(chars.data(), idx, chars.size());
+    std::string_view lexeme = chars.substr(start, idx - start);
+    int64_t value = 0;
+    std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), value);
+    return { .type = tt::integer, .lexeme = lexeme, .ival = value };
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "gavcc.h"
+
+enum class ScanSimd {
+    scalar,
+    sse2,
+    avx2,
+};
+
+namespace char_span {
+    using SpanFn = size_t (*)(const char* s, size_t i, size_t size);
+
+    struct Kernels {
+        SpanFn whitespace;
+        SpanFn id_chars;
+        SpanFn digits;
+    };
+
+    // The widest vector width the CPU supports
+    ScanSimd best();
+    Kernels kernels(ScanSimd simd);
+}
+
+// Tokens hold views into chars, which must outlive them. Runs of
+// whitespace, identifier characters and digits are skipped with the span
+// kernels, by default the widest vector width the CPU supports.
+class Scanner {
+    const std::string_view chars;
+    Interner& names;
+    const char_span::Kernels spans;
+    size_t idx = 0;
+
+public:
+    Scanner(std::string_view chars, Interner& names, ScanSimd simd = char_span::best()):
+        chars(chars), names(names), spans(char_span::kernels(simd)) {}
+
+    // Materializes the whole stream, not counting the trailing eof
+    std::vector<Token> scan();
+
+    // Returns the next token, or eof forever once the input is exhausted
+    Token next_token();
+
+private:
+    Token punct(TokenType type);
+    Token scan_id();
+    Token scan_number();
+};
@@ -1,131 +1,149 @@
-#include "gavcc.h"
+#include "semanal.h"
 #include <format>
-#include <unordered_set>
-#include <iostream>
 
 using std::string;
-template <typename T>
-using set = std::unordered_set<T>;
-using std::cout;
-using std::endl;
 using nt = NodeType;
 using tt = TokenType;
 
 void sem_anal_error(string msg);
 
-class ScopedDeclSet {
-    vector<set<string>> scopes;
-public:
-    ScopedDeclSet() {
-        scopes.push_back({});
+void SemAnal::sem_anal() {
+    sem_anal_node(ast);
+    ast->frame_size = scopes.frame_size();
+}
+
+// Visits in the same order as a recursive walk, so the first error
+// reported is the same, but nesting depth only costs heap
+void SemAnal::sem_anal_node(Node* root) {
+    Node* cur = root;
+    while(true) {
+        while(cur) {
+            cur = visit(cur);
+        }
+        if(pending.empty()) {
+            return;
+        }
+        cur = pending.back();
+        pending.pop_back();
+        if(!cur) {
+            scopes.close_scope();
+        }
     }
-    void add_decl(string sym);
-    bool is_decled(string sym);
-    void add_scope();
-    void close_scope();
-};
+}
 
-class SemAnal {
-    Node* ast;
-    ScopedDeclSet scopes;
+Node* SemAnal::visit_prgm(Node* cur) {
+    return push_stmts(cur);
+}
 
-public:
+Node* SemAnal::visit_block(Node* cur) {
+    scopes.add_scope();
+    pending.push_back(nullptr);
+    return push_stmts(cur);
+}
 
-    SemAnal(Node* ast): ast(ast) {}
+Node* SemAnal::visit_stmt_while(Node* cur) {
+    pending.push_back(cur->body);
+    return cur->expr;
+}
 
-    void sem_anal() {
-        sem_anal_node(ast);
+Node* SemAnal::visit_stmt_decl(Node* cur) {
+    SymId sym = cur->sym;
+    if(scopes.find_slot(sym) >= 0) {
+        sem_anal_error(std::format("Tried to declare, but symbol '{}' is already declared", names.name(sym)));
     }
+    cur->slot = scopes.add_decl(sym);
+    return nullptr;
+}
 
-private:
-    void sem_anal_node(Node* cur) {
-        nt type = cur->type;
-        if(type == nt::prgm) {
-            for(Node* stmt : cur->stmts) {
-                sem_anal_node(stmt);
-            }
-        }
-        else if(type == nt::block) {
-            scopes.add_scope();
-            for(Node* stmt : cur->stmts) {
-                sem_anal_node(stmt);
-            }
-            scopes.close_scope();
-        }
-        else if(type == nt::stmt_while) {
-            sem_anal_node(cur->expr);
-            sem_anal_node(cur->body);
-        }
-        else if(type == nt::stmt_decl) {
-            string sym = cur->id;
-            if(scopes.is_decled(sym)) {
-                sem_anal_error(std::format("Tried to declare, but symbol '{}' is already declared", sym));
-            }
-            scopes.add_decl(sym);
-        }
-        else if(type == nt::stmt_assn) {
-            string sym = cur->id;
-            if(!scopes.is_decled(sym)) {
-                sem_anal_error(std::format("Tried to assign value, but symbol '{}' has not been declared", sym));
-            }
-            sem_anal_node(cur->expr);
-        }
-        else if(type == nt::stmt_return) {
-            sem_anal_node(cur->expr);
-        }
-        else if(type == nt::paren_group) {
-            sem_anal_node(cur->expr);
-        }
-        else if(type == nt::biop_plus
-                || type == nt::biop_minus
-                || type == nt::biop_mul
-                || type == nt::biop_div) {
-            sem_anal_node(cur->left);
-            sem_anal_node(cur->right);
-        }
-        else if(type == nt::unary_plus
-                || type == nt::unary_minus) {
-            sem_anal_node(cur->expr);
-        }
-        else if(type == nt::lit_int) {
-            // nothing
-        }
-        else if(type == nt::lit_id) {
-            string sym = cur->id;
-            if(!scopes.is_decled(sym)) {
-                sem_anal_error(std::format("Tried to use symbol, but symbol '{}' has not been declared", sym));
-            }
-        }
+Node* SemAnal::visit_stmt_assn(Node* cur) {
+    SymId sym = cur->sym;
+    cur->slot = scopes.find_slot(sym);
+    if(cur->slot < 0) {
+        sem_anal_error(std::format("Tried to assign value, but symbol '{}' has not been declared", names.name(sym)));
     }
+    return cur->expr;
+}
+
+Node* SemAnal::visit_stmt_return(Node* cur) {
+    return cur->expr;
+}
+
+Node* SemAnal::visit_paren_group(Node* cur) {
+    return cur->expr;
+}
+
+Node* SemAnal::visit_binary(Node* cur) {
+    pending.push_back(cur->right);
+    return cur->left;
+}
+
+Node* SemAnal::visit_unary(Node* cur) {
+    return cur->expr;
+}
 
-};
+Node* SemAnal::visit_lit_int(Node*) {
+    return nullptr;
+}
+
+Node* SemAnal::visit_lit_id(Node* cur) {
+    SymId sym = cur->sym;
+    cur->slot = scopes.find_slot(sym);
+    if(cur->slot < 0) {
+        sem_anal_error(std::format("Tried to use symbol, but symbol '{}' has not been declared", names.name(sym)));
+    }
+    return nullptr;
+}
+
+// Queues all statements of cur but the first, which it returns
+Node* SemAnal::push_stmts(Node* cur) {
+    if(cur->stmts.empty()) {
+        return nullptr;
+    }
+    for(size_t i = cur->stmts.size(); i-- > 1;) {
+        pending.push_back(cur->stmts[i]);
+    }
+    return cur->stmts[0];
+}
 
 void sem_anal_error(string msg) {
-    cout << msg << endl;
-    exit(6);
+    compile_error(msg, 6);
 }
 
-void ScopedDeclSet::add_decl(string sym) {
-    scopes.back().insert(sym);
+int32_t ScopedDeclSet::add_decl(SymId sym) {
+    int32_t slot = decls.size();
+    decls.push_back(sym);
+    if(slot + 1 > max_slots) {
+        max_slots = slot + 1;
+    }
+    if(sym >= slot_of.size()) {
+        slot_of.resize(sym + 1, -1);
+    }
+    slot_of[sym] = slot;
+    return slot;
 }
 
-bool ScopedDeclSet::is_decled(string sym) {
-    for(auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-        if(it->contains(sym)) {
-            return true;
-        }
+int32_t ScopedDeclSet::find_slot(SymId sym) {
+    if(sym < slot_of.size()) {
+        return slot_of[sym];
     }
-    return false;
+    return -1;
+}
+
+int32_t ScopedDeclSet::frame_size() {
+    return max_slots;
 }
 
 void ScopedDeclSet::add_scope() {
-    scopes.push_back({});
+    scope_starts.push_back(decls.size());
 }
 
 void ScopedDeclSet::close_scope() {
-    if(scopes.size() == 1) {
-        cout << "Error: tried to destroy global scope" << endl;
-        exit(7);
+    if(scope_starts.size() == 1) {
+        compile_error("Error: tried to destroy global scope", 7);
+    }
+    while((int32_t)decls.size() > scope_starts.back()) {
+        slot_of[decls.back()] = -1;
+        decls.pop_back();
     }
-    scopes.pop_back();
+    scope_starts.pop_back();
 }
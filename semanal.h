@@ -0,0 +1,57 @@
+#pragma once
+#include "gavcc.h"
+#include "visitor.h"
+
+// Maps each declared symbol to a frame slot. Slots are handed out like a
+// stack, so sibling blocks reuse the slots of a closed scope. Symbols are
+// dense interned ids, so lookups index a vector instead of hashing.
+class ScopedDeclSet {
+    // Slot currently bound to each symbol, or -1
+    vector<int32_t> slot_of;
+    // Symbol declared in each live slot
+    vector<SymId> decls;
+    vector<int32_t> scope_starts;
+    int32_t max_slots = 0;
+public:
+    ScopedDeclSet() {
+        scope_starts.push_back(0);
+    }
+    int32_t add_decl(SymId sym);
+    int32_t find_slot(SymId sym);
+    int32_t frame_size();
+    void add_scope();
+    void close_scope();
+};
+
+// Visit functions return the child to visit next, having queued the rest
+class SemAnal : public NodeVisitor<SemAnal, Node*> {
+    friend class NodeVisitor<SemAnal, Node*>;
+    Node* ast;
+    const Interner& names;
+    ScopedDeclSet scopes;
+    // Nodes still to visit, last first. A null entry closes the scope of
+    // the block above it.
+    vector<Node*> pending;
+
+public:
+
+    SemAnal(Node* ast, const Interner& names): ast(ast), names(names) {}
+
+    void sem_anal();
+
+private:
+    void sem_anal_node(Node* root);
+    Node* push_stmts(Node* cur);
+
+    Node* visit_prgm(Node* cur);
+    Node* visit_block(Node* cur);
+    Node* visit_stmt_while(Node* cur);
+    Node* visit_stmt_decl(Node* cur);
+    Node* visit_stmt_assn(Node* cur);
+    Node* visit_stmt_return(Node* cur);
+    Node* visit_paren_group(Node* cur);
+    Node* visit_binary(Node* cur);
+    Node* visit_unary(Node* cur);
+    Node* visit_lit_int(Node* cur);
+    Node* visit_lit_id(Node* cur);
+};
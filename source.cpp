@@ -0,0 +1,42 @@
+#include "source.h"
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string read_file(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+
+    std::string content;
+    content.resize(std::filesystem::file_size(filename));
+    file.read(content.data(), content.size());
+    return content;
+}
+
+SourceFile::SourceFile(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size = st.st_size;
+        map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED) {
+            madvise(map, size, MADV_SEQUENTIAL);
+        }
+    }
+    if(fd >= 0) {
+        close(fd);
+    }
+    if(map == MAP_FAILED) {
+        content = read_file(filename);
+    }
+}
+
+SourceFile::~SourceFile() {
+    if(map != MAP_FAILED) {
+        munmap(map, size);
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "gavcc.h"
+#include <sys/mman.h>
+
+std::string read_file(const std::string& filename);
+
+// Read-only view of a whole file. Regular files are mmapped so the scanner
+// can point tokens straight into the page cache without copying, anything
+// mmap can't handle (empty files, pipes) falls back to read_file.
+class SourceFile {
+    void* map = MAP_FAILED;
+    size_t size = 0;
+    string content;
+
+public:
+    SourceFile(const string& filename);
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    ~SourceFile();
+
+    std::string_view text() const {
+        if(map != MAP_FAILED) {
+            return { static_cast<const char*>(map), size };
+        }
+        return content;
+    }
+};
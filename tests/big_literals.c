@@ -0,0 +1 @@
+int a; a = 4611686018427387904; return a; return a - 1 + a; return -a - a;
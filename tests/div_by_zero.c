@@ -0,0 +1 @@
+int a; a = 0; return 1; return 5 / a;
@@ -0,0 +1 @@
+int a; a = -7; return a / 2; return 7 / -2; return -7 / -2; return a - a / 3 * 3;
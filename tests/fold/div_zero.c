@@ -0,0 +1 @@
+int a; a = 7; return a / 1 + (2 - 2) * a; return 5 / (3 - 3);
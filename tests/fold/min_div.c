@@ -0,0 +1 @@
+int a; a = 9223372036854775807; return -a - 1; return (0 - 9223372036854775807 - 1) / -1;
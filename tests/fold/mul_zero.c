@@ -0,0 +1 @@
+int a; int u; a = 0; return (1 + 2) * 0 + 0 * (4 / 2); while(a) { return (5 / 0) * 0; return 0 * (a / a); } return a * 0; return u * 0;
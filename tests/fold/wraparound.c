@@ -0,0 +1 @@
+int a; a = 9223372036854775807 + 1; return a; return -(0 - 9223372036854775807 - 1); return 4611686018427387904 * 4 + 3; return 0 - a - 1; return --a;
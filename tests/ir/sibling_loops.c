@@ -0,0 +1 @@
+int a; int b; int i; int s; a = 3; b = 4; s = 0; i = 2; while(i) { s = s + a * b; i = i - 1; } i = 2; while(i) { s = s + a * b; i = i - 1; } return s;
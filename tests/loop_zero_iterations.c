@@ -0,0 +1 @@
+int x; x = 0; while(x) { return 1; } while(x - x) { x = 5; } return x; return +(-(+x));
@@ -0,0 +1,3 @@
+int i; int j; int s; s = 0; i = 30;
+while(i) { j = i; while(j) { s = s + i * j; j = j - 1; } i = i - 1; }
+return s; int z; z = 0; while(z) { while(z) { return 99; } } return -(-(-s));
@@ -0,0 +1,7 @@
+int a; int b; int c; int d; int e; int f; int g; int h; int i; int j; int k; int l; int m; int n;
+a = 1; b = 2; c = 3; d = 4; e = 5; f = 6; g = 7; h = 8; i = 9; j = 10; k = 11; l = 12; m = 13; n = 14;
+return a + (b + (c + (d + (e + (f + (g + (h + (i + (j + (k + (l + (m + n))))))))))));
+return (a * b - c) * (d * e - f) * (g * h - i) - (j * k - l) * (m * n - a) / (b + c);
+int s; s = 0; int t; t = 100;
+while(t) { s = s + a * t - b + c * d - e / f + g - h * i + j - k + l * m - n; t = t - 1; }
+return s; return a + b + c + d + e + f + g + h + i + j + k + l + m + n;
@@ -0,0 +1 @@
+int x; int i; i = 3; while(i) { x = i; i = i - 1; } return x;
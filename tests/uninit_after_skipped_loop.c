@@ -0,0 +1 @@
+int y; int n; n = 0; while(n) { y = 2; } return 7; return y;
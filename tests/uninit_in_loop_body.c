@@ -0,0 +1 @@
+int i; i = 2; while(i) { int z; return i; z = z + 1; i = i - 1; }
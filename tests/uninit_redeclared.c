@@ -0,0 +1 @@
+int i; i = 2; while(i) { int z; z = i; return z; i = i - 1; } { int w; w = 3; return w; } { int v; return v + 1; }
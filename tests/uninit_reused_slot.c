@@ -0,0 +1 @@
+int x; x = 5; { int a; a = 41; } { int b; return b; }
@@ -0,0 +1,210 @@
+#include "gavcc.h"
+#include "visitor.h"
+
+// The AST dump, walked with an explicit stack. A task is a node, or a
+// label line, at some depth below indent. Each visit finishes the line
+// print started for its node and queues what goes below it, last first.
+class NodePrinter : public NodeVisitor<NodePrinter> {
+    friend class NodeVisitor<NodePrinter>;
+    struct Task {
+        Node* node;
+        size_t depth;
+        const char* label;
+    };
+    const Interner& names;
+    const string& indent;
+    vector<Task> pending;
+    string s;
+    // Depth of the children of the node being visited
+    size_t child = 0;
+
+public:
+    NodePrinter(const Interner& names, const string& indent): names(names), indent(indent) {}
+
+    string print(Node* root) {
+        pending.push_back({ root, 0 });
+        while(!pending.empty()) {
+            Task task = pending.back();
+            pending.pop_back();
+            start_line(task.depth);
+            if(task.label) {
+                s += task.label;
+                s += "\n";
+                continue;
+            }
+            s += to_string::node_type(task.node->type) + ": ";
+            child = task.depth + 1;
+            visit(task.node);
+        }
+        return std::move(s);
+    }
+
+private:
+    void start_line(size_t depth) {
+        s += indent;
+        s.append(depth * 4, ' ');
+    }
+
+    void stmts(Node* node) {
+        s += "\n";
+        for(size_t i = node->stmts.size(); i-- > 0;) {
+            pending.push_back({ node->stmts[i], child });
+        }
+    }
+
+    // The node's line, then its one child
+    void expr(Node* node) {
+        s += "\n";
+        pending.push_back({ node->expr, child });
+    }
+
+    void visit_prgm(Node* node) {
+        stmts(node);
+    }
+
+    void visit_block(Node* node) {
+        stmts(node);
+    }
+
+    void visit_stmt_while(Node* node) {
+        s += "\n";
+        pending.push_back({ node->body, child + 1 });
+        pending.push_back({ nullptr, child + 1, "stmts:" });
+        pending.push_back({ node->expr, child + 1 });
+        pending.push_back({ nullptr, child, "while:" });
+    }
+
+    void visit_stmt_decl(Node* node) {
+        s += "\n";
+        start_line(child);
+        s += "name: " + names.name(node->sym) + "\n";
+    }
+
+    void visit_stmt_assn(Node* node) {
+        s += "\n";
+        start_line(child);
+        s += "name: " + names.name(node->sym) + "\n";
+        pending.push_back({ node->expr, child + 1 });
+        pending.push_back({ nullptr, child, "expr:" });
+    }
+
+    void visit_stmt_return(Node* node) {
+        s += "\n";
+        pending.push_back({ node->expr, child + 1 });
+        pending.push_back({ nullptr, child, "expr:" });
+    }
+
+    void visit_paren_group(Node* node) {
+        expr(node);
+    }
+
+    void visit_unary(Node* node) {
+        expr(node);
+    }
+
+    void visit_binary(Node* node) {
+        s += "\n";
+        pending.push_back({ node->right, child });
+        pending.push_back({ node->left, child });
+    }
+
+    void visit_lit_int(Node* node) {
+        s += std::to_string(node->ival) + "\n";
+    }
+
+    void visit_lit_id(Node* node) {
+        s += names.name(node->sym) + "\n";
+    }
+};
+
+namespace to_string {
+    string tokens(vector<Token> tokens) {
+        string s;
+        for(Token token : tokens) {
+            s += to_string::token(token) + " ";
+        }
+        return s;
+    }
+
+    string token(Token token) {
+        return to_string::token_type(token.type);
+    }
+
+    string token_type(TokenType type) {
+        switch(type) {
+            case TokenType::kw_int:
+                return "kw:int";
+            case TokenType::kw_return:
+                return "kw:return";
+            case TokenType::kw_while:
+                return "kw:while";
+            case TokenType::id:
+                return "id";
+            case TokenType::lbrace:
+                return "{";
+            case TokenType::rbrace:
+                return "}";
+            case TokenType::lparen:
+                return "(";
+            case TokenType::rparen:
+                return ")";
+            case TokenType::integer:
+                return "<int>";
+            case TokenType::plus:
+                return "+";
+            case TokenType::minus:
+                return "-";
+            case TokenType::star:
+                return "*";
+            case TokenType::div:
+                return "/";
+            case TokenType::equal:
+                return "=";
+            case TokenType::semicolon:
+                return ";";
+            case TokenType::eof:
+                return "EOF";
+        }
+        return "[UNIMP]";
+    }
+
+    string node(Node* root, const Interner& names, string indent) {
+        return NodePrinter(names, indent).print(root);
+    }
+
+    string node_type(NodeType type) {
+        switch(type) {
+            case NodeType::prgm:
+                return "prgm";
+            case NodeType::block:
+                return "block";
+            case NodeType::stmt_decl:
+                return "stmt:decl";
+            case NodeType::stmt_assn:
+                return "stmt:assn";
+            case NodeType::stmt_return:
+                return "stmt:return";
+            case NodeType::stmt_while:
+                return "stmt:while";
+            case NodeType::paren_group:
+                return "paren_group";
+            case NodeType::biop_plus:
+                return "biop_plus";
+            case NodeType::biop_minus:
+                return "biop:minus";
+            case NodeType::biop_mul:
+                return "biop:mul";
+            case NodeType::biop_div:
+                return "biop:div";
+            case NodeType::unary_plus:
+                return "unary:plus";
+            case NodeType::unary_minus:
+                return "unary:minus";
+            case NodeType::lit_int:
+                return "lit:int";
+            case NodeType::lit_id:
+                return "lit:id";
+        }
+        return "UNRECOG NODE TYPE";
+    }
+}
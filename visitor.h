@@ -0,0 +1,133 @@
+#pragma once
+#include "gavcc.h"
+
+// Dispatches on NodeType with one switch, which compiles to a jump table,
+// instead of a chain of comparisons that the most common nodes, the
+// literals, reach last.
+//
+// A pass derives from NodeVisitor<Pass, Result> and defines
+// visit_<type>(Node*) for the node types it handles. The four binary
+// operators fall back to visit_binary and the two unary ones to
+// visit_unary, and whatever is still left to visit_other. A pass that
+// doesn't define visit_other has to handle every type, or it doesn't
+// compile, and a new NodeType doesn't compile until the switch has a case
+// for it.
+template <typename Derived, typename Result = void>
+class NodeVisitor {
+public:
+    // Inlined into every caller, so a visit_* that returns the next node
+    // runs in the caller's loop without a call per node
+    [[gnu::always_inline]] Result visit(Node* node) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Wswitch"
+        switch(node->type) {
+            case NodeType::prgm:
+                return self().visit_prgm(node);
+            case NodeType::block:
+                return self().visit_block(node);
+            case NodeType::stmt_while:
+                return self().visit_stmt_while(node);
+            case NodeType::stmt_decl:
+                return self().visit_stmt_decl(node);
+            case NodeType::stmt_assn:
+                return self().visit_stmt_assn(node);
+            case NodeType::stmt_return:
+                return self().visit_stmt_return(node);
+            case NodeType::paren_group:
+                return self().visit_paren_group(node);
+            case NodeType::biop_plus:
+                return self().visit_biop_plus(node);
+            case NodeType::biop_minus:
+                return self().visit_biop_minus(node);
+            case NodeType::biop_mul:
+                return self().visit_biop_mul(node);
+            case NodeType::biop_div:
+                return self().visit_biop_div(node);
+            case NodeType::unary_plus:
+                return self().visit_unary_plus(node);
+            case NodeType::unary_minus:
+                return self().visit_unary_minus(node);
+            case NodeType::lit_int:
+                return self().visit_lit_int(node);
+            case NodeType::lit_id:
+                return self().visit_lit_id(node);
+        }
+#pragma GCC diagnostic pop
+        // Only a corrupt node gets here
+        __builtin_unreachable();
+    }
+
+protected:
+    Result visit_prgm(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_block(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_stmt_while(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_stmt_decl(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_stmt_assn(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_stmt_return(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_paren_group(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_biop_plus(Node* node) {
+        return self().visit_binary(node);
+    }
+
+    Result visit_biop_minus(Node* node) {
+        return self().visit_binary(node);
+    }
+
+    Result visit_biop_mul(Node* node) {
+        return self().visit_binary(node);
+    }
+
+    Result visit_biop_div(Node* node) {
+        return self().visit_binary(node);
+    }
+
+    Result visit_binary(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_unary_plus(Node* node) {
+        return self().visit_unary(node);
+    }
+
+    Result visit_unary_minus(Node* node) {
+        return self().visit_unary(node);
+    }
+
+    Result visit_unary(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_lit_int(Node* node) {
+        return self().visit_other(node);
+    }
+
+    Result visit_lit_id(Node* node) {
+        return self().visit_other(node);
+    }
+
+private:
+    Derived& self() {
+        return static_cast<Derived&>(*this);
+    }
+};